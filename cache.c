@@ -12,10 +12,11 @@
  * printSummary - Summarize the cache simulation statistics. Cache simulators
  *                must call this function in order to be properly autograded. 
  */
-void printSummary(int hits, int misses, int evictions) {
-    printf("hits:%d misses:%d evictions:%d\n", hits, misses, evictions);
+void printSummary(unsigned long long hits, unsigned long long misses,
+                  unsigned long long evictions) {
+    printf("hits:%llu misses:%llu evictions:%llu\n", hits, misses, evictions);
     FILE* output_fp = fopen(".cachesim_results", "w");
     assert(output_fp);
-    fprintf(output_fp, "%d %d %d\n", hits, misses, evictions);
+    fprintf(output_fp, "%llu %llu %llu\n", hits, misses, evictions);
     fclose(output_fp);
 }
@@ -0,0 +1,754 @@
+/*
+ * cachecore.c - The cache model: replacement policies, set scanning,
+ * and block accesses under the write policies and prefetchers
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "cachecore.h"
+
+/* Seed of the random and BRRIP policies, fixed so runs are repeatable */
+#define RANDOM_SEED 0x2545F4914F6CDD1DULL
+
+/* Number of accesses to a set between two LFU agings of its counts */
+#define LFU_AGE_PERIOD 256
+
+/* Largest re-reference prediction value of SRRIP and BRRIP */
+#define RRPV_MAX 3
+
+/* BRRIP inserts with a long rather than distant prediction 1 in this many fills */
+#define BRRIP_LONG_ODDS 32
+
+/*
+ * Returns the next number from the xorshift generator of set index.
+ * Each set has its own generator in its first state word, so a set's
+ * choices only depend on the accesses to that set.
+ */
+static inline unsigned long long nextRandom(cache* cache, unsigned long long index){
+	unsigned long long* state = setState(cache, index);
+	unsigned long long x = *state;
+	if(x == 0){
+		x = RANDOM_SEED ^ ((index + 1) * 0x9E3779B97F4A7C15ULL);
+	}
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/* Returns the way with the smallest metadata word in set index */
+static inline int minMetaWay(cache* cache, unsigned long long index){
+	unsigned long long* meta = setMeta(cache, index);
+	int way = 0;
+	for(int j = 1; j < cache->E; j++){
+		if(meta[j] < meta[way]){
+			way = j;
+		}
+	}
+	return way;
+}
+
+/* LRU: each line's metadata is the time it was last accessed */
+static void lruTouch(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way] = ++cache->clock;
+}
+
+/* For policies that do not care about an event, e.g. FIFO about hits */
+static void ignoreTouch(cache* cache, unsigned long long index, int way){
+}
+
+/* FIFO reuses lruTouch on fills, so each line's metadata is the time
+ * it was filled */
+
+/* Random: evict any way with equal probability */
+static int randomVictim(cache* cache, unsigned long long index){
+	return nextRandom(cache, index) % cache->E;
+}
+
+/*
+ * Tree pseudo-LRU: the ways are the leaves of a binary tree with one
+ * bit per inner node, stored heap-ordered (root at 1) in the state
+ * words. A bit of 0 means the victim is to the left. Sets with E not a
+ * power of two use the tree of the next power of two, and never walk
+ * into subtrees that only hold nonexistent ways.
+ */
+static inline int plruLeaves(int E){
+	int leaves = 1;
+	while(leaves < E){
+		leaves *= 2;
+	}
+	return leaves;
+}
+
+static void plruTouch(cache* cache, unsigned long long index, int way){
+	unsigned long long* bits = setState(cache, index);
+	int leaves = plruLeaves(cache->E);
+	/* Walk from the leaf up, pointing every node away from way */
+	for(int node = (leaves + way) / 2, child = leaves + way; node >= 1;
+										child = node, node /= 2){
+		if(child & 1){
+			bits[node / 64] &= ~(1ULL << (node % 64));
+		} else {
+			bits[node / 64] |= 1ULL << (node % 64);
+		}
+	}
+}
+
+static int plruVictim(cache* cache, unsigned long long index){
+	unsigned long long* bits = setState(cache, index);
+	int leaves = plruLeaves(cache->E);
+	int node = 1;
+	int width = leaves;
+	int first = 0;
+	while(node < leaves){
+		width /= 2;
+		int right = (bits[node / 64] >> (node % 64)) & 1;
+		/* The right subtree's ways start at first + width */
+		if(right && first + width < cache->E){
+			first += width;
+			node = 2 * node + 1;
+		} else {
+			node = 2 * node;
+		}
+	}
+	return first;
+}
+
+/*
+ * SRRIP and BRRIP: each line's metadata is its re-reference prediction
+ * value (RRPV). Hits predict a near re-reference, and the victim is a
+ * line predicted to be re-referenced in the distant future.
+ */
+static void rripHit(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way] = 0;
+}
+
+static void srripFill(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way] = RRPV_MAX - 1;
+}
+
+static void brripFill(cache* cache, unsigned long long index, int way){
+	int longPrediction = nextRandom(cache, index) % BRRIP_LONG_ODDS == 0;
+	setMeta(cache, index)[way] = longPrediction ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+static int rripVictim(cache* cache, unsigned long long index){
+	unsigned long long* meta = setMeta(cache, index);
+	/* Age every line by as much as it takes for one to become distant */
+	int way = 0;
+	for(int j = 1; j < cache->E; j++){
+		if(meta[j] > meta[way]){
+			way = j;
+		}
+	}
+	unsigned long long age = RRPV_MAX - meta[way];
+	if(age > 0){
+		for(int j = 0; j < cache->E; j++){
+			meta[j] += age;
+		}
+	}
+	return way;
+}
+
+/*
+ * LFU with aging: each line's metadata counts its accesses, and every 
+ * LFU_AGE_PERIOD accesses to a set (counted in its second state word)
+ * all of the set's counts are halved so that old popularity fades.
+ */
+static void lfuAge(cache* cache, unsigned long long index){
+	unsigned long long* accesses = &setState(cache, index)[1];
+	if(++*accesses % LFU_AGE_PERIOD == 0){
+		unsigned long long* meta = setMeta(cache, index);
+		for(int j = 0; j < cache->E; j++){
+			meta[j] /= 2;
+		}
+	}
+}
+
+static void lfuHit(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way]++;
+	lfuAge(cache, index);
+}
+
+static void lfuFill(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way] = 1;
+	lfuAge(cache, index);
+}
+
+/*
+ * Bélády's optimal policy: each line's metadata is the time of its next
+ * access, which the caller works out ahead and puts in cache->nextUse,
+ * and the victim is the line whose next access is farthest away.
+ */
+static void optimalTouch(cache* cache, unsigned long long index, int way){
+	setMeta(cache, index)[way] = cache->nextUse;
+}
+
+static int optimalVictim(cache* cache, unsigned long long index){
+	unsigned long long* meta = setMeta(cache, index);
+	int way = 0;
+	for(int j = 1; j < cache->E; j++){
+		if(meta[j] > meta[way]){
+			way = j;
+		}
+	}
+	return way;
+}
+
+static const replacementPolicy optimal = 
+	{ "opt", optimalTouch, optimalTouch, optimalVictim };
+
+static const replacementPolicy policies[] = {
+	{ "lru", lruTouch, lruTouch, minMetaWay },
+	{ "fifo", ignoreTouch, lruTouch, minMetaWay },
+	{ "random", ignoreTouch, ignoreTouch, randomVictim },
+	{ "plru", plruTouch, plruTouch, plruVictim },
+	{ "srrip", rripHit, srripFill, rripVictim },
+	{ "brrip", rripHit, brripFill, rripVictim },
+	{ "lfu", lfuHit, lfuFill, minMetaWay },
+};
+
+/*
+ * Returns the replacement policy called name, or NULL if there is no
+ * such policy. 
+ */
+const replacementPolicy* findPolicy(const char* name){
+	for(size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++){
+		if(strcmp(policies[i].name, name) == 0){
+			return &policies[i];
+		}
+	}
+	return NULL;
+}
+
+const replacementPolicy* optimalPolicy(void){
+	return &optimal;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Vector set scanners. They compare 8 ways per step and stop at the
+ * first step with a hit. They may read up to 7 tags past the last way
+ * they were asked about, which is harmless because at least 4 words of
+ * policy metadata and 2 words of policy state follow the tags in a 
+ * set's block, and up to 7 valid bytes past it, which is covered by 
+ * the valid bytes' padding. Ways past count are never reported.
+ */
+#include <immintrin.h>
+
+/* Returns a mask of the invalid ways among valid[0..count), 8 at a time */
+__attribute__((target("sse4.1")))
+static inline unsigned long long invalidWays(const unsigned char* valid, int count){
+	unsigned long long invalid = 0;
+	__m128i zero = _mm_setzero_si128();
+	for(int j = 0; j < count; j += 8){
+		__m128i bytes = _mm_loadl_epi64((const __m128i*) (valid + j));
+		unsigned long long m = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)) & 0xff;
+		invalid |= m << j;
+	}
+	return invalid & lowBits(count);
+}
+
+__attribute__((target("avx2")))
+static int scanAVX2(const unsigned long long* tags, const unsigned char* valid, 
+					int count, unsigned long long tag, 
+					unsigned long long* invalidMask){
+	unsigned long long invalid = invalidWays(valid, count);
+	unsigned long long live = ~invalid & lowBits(count);
+	*invalidMask = invalid;
+
+	__m256i key = _mm256_set1_epi64x(tag);
+	for(int j = 0; j < count; j += 8){
+		__m256i low = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (tags + j)), key);
+		__m256i high = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (tags + j + 4)), key);
+		unsigned long long equal = _mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+								   (_mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4);
+		unsigned long long hits = (equal << j) & live;
+		if(hits != 0){
+			return __builtin_ctzll(hits);
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("sse4.1")))
+static int scanSSE4(const unsigned long long* tags, const unsigned char* valid, 
+					int count, unsigned long long tag, 
+					unsigned long long* invalidMask){
+	unsigned long long invalid = invalidWays(valid, count);
+	unsigned long long live = ~invalid & lowBits(count);
+	*invalidMask = invalid;
+
+	__m128i key = _mm_set1_epi64x(tag);
+	for(int j = 0; j < count; j += 8){
+		unsigned long long equal = 0;
+		for(int k = 0; k < 8; k += 2){
+			__m128i ways = _mm_loadu_si128((const __m128i*) (tags + j + k));
+			__m128d same = _mm_castsi128_pd(_mm_cmpeq_epi64(ways, key));
+			equal |= (unsigned long long) _mm_movemask_pd(same) << k;
+		}
+		unsigned long long hits = (equal << j) & live;
+		if(hits != 0){
+			return __builtin_ctzll(hits);
+		}
+	}
+	return -1;
+}
+#endif
+
+/* Sets with fewer ways than this are faster to compare one at a time */
+#define SIMD_MIN_WAYS 4
+
+/*
+ * Returns the best set scanner this CPU supports for sets of E ways,
+ * or NULL for the scalar loop. Setting CACHESIM_SIMD to scalar or sse4
+ * caps the choice, which is handy for checking the paths against each
+ * other.
+ */
+static setScanner pickScanner(int E){
+	if(E < SIMD_MIN_WAYS){
+		return NULL;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	const char* cap = getenv("CACHESIM_SIMD");
+	int allowAVX2 = cap == NULL || strcmp(cap, "avx2") == 0;
+	int allowSSE4 = allowAVX2 || strcmp(cap, "sse4") == 0;
+	__builtin_cpu_init();
+	if(allowAVX2 && __builtin_cpu_supports("avx2")){
+		return scanAVX2;
+	}
+	if(allowSSE4 && __builtin_cpu_supports("sse4.1")){
+		return scanSSE4;
+	}
+#endif
+	return NULL;
+}
+
+/*
+ * This method takes as input four parameters:
+ * 	s: the number of set bits 
+ * 	E: the number of lines per cacheset
+ * 	b: the number of offset bits
+ * 	policy: the replacement policy, or NULL for LRU
+ *
+ * We construct a cache with S = 2^s cache sets, each of 
+ * which hold E cacheLines. All sets share a single zeroed 
+ * allocation, so every line starts out invalid with tag 0.
+ * The allocation is an anonymous mapping that reserves no memory,
+ * so pages of sets are only backed (by zeroes) once written, and
+ * making even a cache of gigabytes takes constant time. It returns
+ * NULL if the cache cannot be allocated, since the library's callers 
+ * must not be exited on.
+ */
+cache* makeCache(int s, int E, int b, const replacementPolicy* policy) {
+	cache* c = (cache*) calloc(1, sizeof(cache));
+	if(c == NULL){
+		return NULL;
+	}
+	c->s = s;
+	c->E = E;
+	c->b = b;
+	c->policy = (policy != NULL) ? policy : &policies[0];
+	c->scan = pickScanner(E);
+	c->clock = 0;
+
+	/* Enough state for a pseudo-LRU tree over E ways, and at least the
+	 * two words used by the random generator and LFU aging */
+	c->stateWords = (plruLeaves(E) + 63) / 64;
+	if(c->stateWords < 2){
+		c->stateWords = 2;
+	}
+
+	/* E tags, E metadata words and the state words, then E valid bytes
+	 * rounded up to 8 bytes so that the next set stays 8-byte aligned. */
+	c->setBytes = sizeof(unsigned long long) * (2 * E + c->stateWords) 
+					+ ((E + 7) & ~7);
+
+	/* The mapping is page aligned, so small sets do not straddle more
+	 * hardware cache lines than they need to. */
+	size_t total = c->setBytes << s;
+	size_t touchedBytes = sizeof(unsigned long long) * (((1ULL << s) + 63) / 64);
+	c->sets = (unsigned char*) mmap(NULL, total, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	c->touched = (unsigned long long*) mmap(NULL, touchedBytes, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(c->sets == MAP_FAILED || c->touched == MAP_FAILED){
+		if(c->sets != MAP_FAILED){
+			munmap(c->sets, total);
+		}
+		if(c->touched != MAP_FAILED){
+			munmap(c->touched, touchedBytes);
+		}
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+/*
+ * This method accesses the block holding address, placing it in the 
+ * cache on a miss, and sets *outcome to whether that hit, missed, or
+ * missed and evicted a valid block. It returns the way now holding the
+ * block. 
+ */
+int cacheAccessBlock(cache* cache, unsigned long long address, 
+						accessOutcome* outcome){
+	// Obtain tag and index from address
+	unsigned long long tag = getTagBits(address, cache->s, cache->E, cache->b);
+	unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+
+	int invalid = -1;
+	int way = findWay(cache, index, tag, &invalid);
+
+	/* If our data is already in the cache we tell the replacement 
+	 * policy, and report a hit */
+	if(way >= 0){
+		cache->policy->onHit(cache, index, way);
+		*outcome = ACCESS_HIT;
+		/* The first use of a prefetched block is what made it useful */
+		unsigned char* valid = setValid(cache, index);
+		if(valid[way] & LINE_PREFETCHED){
+			valid[way] &= ~LINE_PREFETCHED;
+			cache->prefetchUseful += 1;
+		}
+		return way;
+	}
+
+	unsigned char* valid = setValid(cache, index);
+	int victim = fillWay(cache, index, invalid);
+	cache->bytesRead += 1ULL << cache->b; // the block comes from memory
+
+	/* If the victim is valid data, we are evicting the block the 
+	 * replacement policy chose. Otherwise we are filling invalid data, which is a 
+	 * miss but not an eviction. */ 
+	if(valid[victim]){
+		*outcome = ACCESS_EVICT;
+		/* Dirty blocks have to be written back before they are replaced */
+		if(valid[victim] & LINE_DIRTY){
+			cache->writebacks += 1;
+			cache->bytesWritten += 1ULL << cache->b;
+		}
+		if(valid[victim] & LINE_PREFETCHED){
+			cache->prefetchUseless += 1;
+		}
+	} else {
+		*outcome = ACCESS_MISS;
+	}
+	setTags(cache, index)[victim] = tag; // update tag
+	valid[victim] = 1;
+	cache->policy->onFill(cache, index, victim); // update policy metadata
+	touchSet(cache, index);
+
+	return victim;
+}
+
+/* What accessCache reports for each outcome when verbose */
+static char* const outcomeInfo[] = { "hit", "miss", "miss eviction" };
+
+/*
+ * This method takes as input the following parameters:
+ *  	cache: the cache we are accessing
+ * 		address: the address of the block in memory we are caching
+ *		evict: a pointer to a counter of the evictions so far
+ *		hits: a pointer to a counter of the hits so far
+ *		misses: a pointer to a counter of the misses so far
+ *  	accessCacheinfo: a pointer to a string that we edit for verbosity. 
+ * 
+ * We noticed that reading, writing were equivalent, therefore this 
+ * serves as a generic cache access for both. We place the block in 
+ * the cache, and update evict, hits, misses counters as well as 
+ * accessCacheinfo string accordingly. It returns the way now holding
+ * the block. 
+ */ 
+int accessCache(cache* cache, unsigned long long address, 
+											unsigned long long* evict, 
+											unsigned long long* hits, 
+											unsigned long long* misses,
+											char** accessCacheInfo){
+	accessOutcome outcome;
+	int way = cacheAccessBlock(cache, address, &outcome);
+	*hits += outcome == ACCESS_HIT;
+	*misses += outcome != ACCESS_HIT;
+	*evict += outcome == ACCESS_EVICT;
+	*accessCacheInfo = outcomeInfo[outcome];
+	return way;
+}
+
+/*
+ * This method looks up address in cache without filling it on a miss.
+ * It returns 1 on a hit, which also makes the block most recently used,
+ * and 0 on a miss. 
+ */
+int cacheLookup(cache* cache, unsigned long long address){
+	unsigned long long tag = getTagBits(address, cache->s, cache->E, cache->b);
+	unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+	int invalid = -1;
+	int way = findWay(cache, index, tag, &invalid);
+	if(way < 0){
+		return 0;
+	}
+	cache->policy->onHit(cache, index, way);
+	unsigned char* valid = setValid(cache, index);
+	if(valid[way] & LINE_PREFETCHED){
+		valid[way] &= ~LINE_PREFETCHED;
+		cache->prefetchUseful += 1;
+	}
+	return 1;
+}
+
+/*
+ * This method places the block holding address into cache, which must
+ * not already hold it. If that evicts a valid block it returns 1 and 
+ * sets *victimAddress to the evicted block's address, otherwise it 
+ * returns 0. 
+ */
+int cacheFill(cache* cache, unsigned long long address, 
+									unsigned long long* victimAddress){
+	unsigned long long tag = getTagBits(address, cache->s, cache->E, cache->b);
+	unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+	int invalid = -1;
+	findWay(cache, index, tag, &invalid);
+	int victim = fillWay(cache, index, invalid);
+
+	unsigned long long* tags = setTags(cache, index);
+	unsigned char* valid = setValid(cache, index);
+	int evicted = valid[victim];
+	if(evicted){
+		*victimAddress = blockAddress(cache, tags[victim], index);
+	}
+	tags[victim] = tag;
+	valid[victim] = 1;
+	cache->policy->onFill(cache, index, victim);
+	touchSet(cache, index);
+	return evicted;
+}
+
+/*
+ * This method removes the block holding address from cache. It returns
+ * 1 if the block was there and 0 otherwise. 
+ */
+int cacheInvalidate(cache* cache, unsigned long long address){
+	unsigned long long tag = getTagBits(address, cache->s, cache->E, cache->b);
+	unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+	int invalid = -1;
+	int way = findWay(cache, index, tag, &invalid);
+	if(way < 0){
+		return 0;
+	}
+	setValid(cache, index)[way] = 0;
+	return 1;
+}
+
+/*
+ * This method brings the block with line address line (the address 
+ * without its offset bits) into cache ahead of demand, unless it is 
+ * already there. The block is marked prefetched until an access uses
+ * it, and a block it evicts is remembered so that a later miss on it 
+ * counts as pollution. 
+ */
+static void prefetchLine(cache* cache, unsigned long long line){
+	if(line > (~0ULL >> cache->b)){
+		return; // past the end of the address space
+	}
+	unsigned long long address = line << cache->b;
+	unsigned long long tag = getTagBits(address, cache->s, cache->E, cache->b);
+	unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+	int invalid = -1;
+	if(findWay(cache, index, tag, &invalid) >= 0){
+		return;
+	}
+	int victim = fillWay(cache, index, invalid);
+
+	unsigned long long* tags = setTags(cache, index);
+	unsigned char* valid = setValid(cache, index);
+	if(valid[victim]){
+		cache->prefetchEvictions += 1;
+		if(valid[victim] & LINE_DIRTY){
+			cache->writebacks += 1;
+			cache->bytesWritten += 1ULL << cache->b;
+		}
+		if(valid[victim] & LINE_PREFETCHED){
+			cache->prefetchUseless += 1;
+		}
+		prefetchEvicted(cache->prefetch, 
+						blockAddress(cache, tags[victim], index) >> cache->b);
+	}
+	tags[victim] = tag;
+	valid[victim] = 1 | LINE_PREFETCHED;
+	cache->policy->onFill(cache, index, victim);
+	touchSet(cache, index);
+	cache->prefetches += 1;
+	cache->bytesRead += 1ULL << cache->b;
+}
+
+/*
+ * This method shows the prefetcher a demand access to address, which 
+ * missed if miss is 1 and hit an unused prefetched block if 
+ * prefetchedHit is 1, and prefetches the lines it asks for. 
+ */
+void runPrefetcher(cache* cache, unsigned long long address, int miss,
+						  int prefetchedHit){
+	unsigned long long line = address >> cache->b;
+	if(miss && prefetchPolluted(cache->prefetch, line)){
+		cache->pollution += 1;
+	}
+	unsigned long long lines[PREFETCH_MAX];
+	int count = prefetchAccess(cache->prefetch, line, miss, prefetchedHit, lines);
+	for(int i = 0; i < count; i++){
+		prefetchLine(cache, lines[i]);
+	}
+}
+
+/*
+ * This method counts the lines with any of flags set in their valid
+ * byte. Only touched sets can hold any, so the others are skipped 
+ * without reading them.
+ */
+static unsigned long long countFlags(cache* cache, unsigned char flags){
+	unsigned long long count = 0;
+	for(unsigned long long w = 0; w < ((1ULL << cache->s) + 63) / 64; w++){
+		for(unsigned long long bits = cache->touched[w]; bits != 0; bits &= bits - 1){
+			unsigned char* valid = setValid(cache, w * 64 + __builtin_ctzll(bits));
+			for(int j = 0; j < cache->E; j++){
+				count += (valid[j] & flags) != 0;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * This method counts the prefetched blocks no access has used yet. 
+ */
+unsigned long long unusedPrefetches(cache* cache){
+	return countFlags(cache, LINE_PREFETCHED);
+}
+
+/*
+ * This method writes the oldest line of the write buffer to memory and
+ * removes it from the buffer. 
+ */
+static void drainWriteBuffer(cache* cache){
+	int chunkShift = (cache->b > 6) ? cache->b - 6 : 0;
+	cache->bytesWritten += (unsigned long long) 
+						   __builtin_popcountll(cache->bufferMasks[0]) << chunkShift;
+	cache->buffered--;
+	memmove(cache->bufferLines, cache->bufferLines + 1, 
+			sizeof(unsigned long long) * cache->buffered);
+	memmove(cache->bufferMasks, cache->bufferMasks + 1, 
+			sizeof(unsigned long long) * cache->buffered);
+}
+
+/*
+ * This method sends a store of size bytes at address to memory. Without
+ * a write buffer it is written at once, otherwise it is merged into the
+ * buffered line it belongs to, or takes a new entry, writing out the 
+ * oldest one if the buffer is full. 
+ */
+static void writeThrough(cache* cache, unsigned long long address, 
+						 unsigned int size){
+	if(cache->write != WRITE_BUFFERED){
+		cache->bytesWritten += size;
+		return;
+	}
+
+	/* The chunks of the line covered by the store, clipped to the line */
+	unsigned long long line = address >> cache->b;
+	unsigned long long lineBytes = 1ULL << cache->b;
+	unsigned long long offset = address & (lineBytes - 1);
+	unsigned long long end = (offset + size < lineBytes) ? offset + size : lineBytes;
+	int chunkShift = (cache->b > 6) ? cache->b - 6 : 0;
+	int first = offset >> chunkShift;
+	int last = (size == 0) ? first : (int) ((end - 1) >> chunkShift);
+	unsigned long long mask = lowBits(last + 1) & ~lowBits(first);
+
+	for(int i = 0; i < cache->buffered; i++){
+		if(cache->bufferLines[i] == line){
+			cache->bufferMasks[i] |= mask;
+			return;
+		}
+	}
+	if(cache->buffered == WRITE_BUFFER_LINES){
+		drainWriteBuffer(cache);
+	}
+	cache->bufferLines[cache->buffered] = line;
+	cache->bufferMasks[cache->buffered] = mask;
+	cache->buffered++;
+}
+
+/*
+ * This method stores size bytes at address according to the cache's 
+ * write policy, and sets *outcome like cacheAccessBlock. Write-back 
+ * fills the block and marks it dirty. The write-through policies only
+ * update the block if it is already there, and pass every store on to
+ * memory. 
+ */
+void cacheStoreBlock(cache* cache, unsigned long long address, unsigned int size,
+						accessOutcome* outcome){
+	if(cache->write == WRITE_BACK){
+		unsigned long long index = getIndexBits(address, cache->s, cache->E, cache->b);
+		int way = cacheAccessBlock(cache, address, outcome);
+		setValid(cache, index)[way] |= LINE_DIRTY;
+		return;
+	}
+
+	*outcome = cacheLookup(cache, address) ? ACCESS_HIT : ACCESS_MISS;
+	writeThrough(cache, address, size);
+}
+
+/*
+ * This method stores size bytes at address like cacheStoreBlock, 
+ * updating the counters and accessCacheInfo like accessCache. 
+ */
+void storeCache(cache* cache, unsigned long long address, unsigned int size,
+										unsigned long long* evict, 
+										unsigned long long* hits, 
+										unsigned long long* misses,
+										char** accessCacheInfo){
+	accessOutcome outcome;
+	cacheStoreBlock(cache, address, size, &outcome);
+	*hits += outcome == ACCESS_HIT;
+	*misses += outcome != ACCESS_HIT;
+	*evict += outcome == ACCESS_EVICT;
+	*accessCacheInfo = outcomeInfo[outcome];
+}
+
+/*
+ * This method empties the write buffer at the end of a run. 
+ */
+void flushWrites(cache* cache){
+	while(cache->buffered > 0){
+		drainWriteBuffer(cache);
+	}
+}
+
+/*
+ * This method returns the number of dirty blocks still in the cache. 
+ */
+unsigned long long dirtyLines(cache* cache){
+	return countFlags(cache, LINE_DIRTY);
+}
+
+/*
+ * This method returns the number of sets any block was placed in.
+ */
+unsigned long long touchedSets(cache* cache){
+	unsigned long long touched = 0;
+	for(unsigned long long w = 0; w < ((1ULL << cache->s) + 63) / 64; w++){
+		touched += __builtin_popcountll(cache->touched[w]);
+	}
+	return touched;
+}
+
+/*
+ * This method frees all allocated space for the cache.  
+ */
+void freeCache(cache* cache){
+	// unmap every cache set at once
+	munmap(cache->sets, cache->setBytes << cache->s);
+	munmap(cache->touched, sizeof(unsigned long long) * (((1ULL << cache->s) + 63) / 64));
+	free(cache); // free cache pointer
+}
+
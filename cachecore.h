@@ -0,0 +1,394 @@
+/*
+ * cachecore.h - The cache model shared by the cachesim command line
+ * tool and libcachesim
+ *
+ * A cache is 2^s sets of E lines of 2^b bytes each. Everything about
+ * it lives in one cache struct, and the functions below access it one
+ * block at a time.
+ */
+
+#ifndef CACHECORE_TOOLS_H
+#define CACHECORE_TOOLS_H
+
+#include <stddef.h>
+#include "prefetch.h"
+#include "intervals.h"
+
+typedef struct replacementPolicy replacementPolicy;
+typedef struct tlb tlb;
+typedef struct classifier classifier;
+
+/*
+ * What a store does to the cache and to the memory below it.
+ *  WRITE_NONE - stores are treated like loads and no traffic is 
+ *  		reported, which is what the autograder expects
+ *  WRITE_BACK - write-back with write-allocate: stores fill the line on
+ *  		a miss and mark it dirty, and dirty lines are written back
+ *  		when they are evicted
+ *  WRITE_THROUGH - write-through with no-write-allocate: every store is
+ *  		written to memory, and a store miss does not fill the line
+ *  WRITE_BUFFERED - like WRITE_THROUGH, but stores go through a small 
+ *  		write buffer that merges stores to the same line
+ */
+typedef enum writePolicy{
+	WRITE_NONE,
+	WRITE_BACK,
+	WRITE_THROUGH,
+	WRITE_BUFFERED
+} writePolicy;
+
+/* Bit of a line's valid byte that marks it dirty */
+#define LINE_DIRTY 2
+
+/* Bit of a line's valid byte that marks it prefetched and not yet used */
+#define LINE_PREFETCHED 4
+
+/* Number of lines the coalescing write buffer holds */
+#define WRITE_BUFFER_LINES 8
+
+/*
+ * A set scanner compares tag against count <= 64 ways at once. It 
+ * returns the first valid way holding tag, or -1 if there is none, 
+ * and sets bit j of *invalidMask if way j is invalid. 
+ */
+typedef int (*setScanner)(const unsigned long long* tags, 
+						  const unsigned char* valid, int count,
+						  unsigned long long tag, unsigned long long* invalidMask);
+
+/* 
+ * Cache struct. Every set lives in one contiguous allocation, so the
+ * metadata for a whole set sits in one or two hardware cache lines
+ * instead of being scattered across E separate mallocs. 
+ * Metadata:
+ *  s, E, b - the geometry of the cache
+ *  policy - the replacement policy that picks victims
+ *  scan - the vector set scanner, or NULL to compare one way at a time
+ *  stateWords - # of 64-bit words of per set state the policy keeps
+ *  setBytes - the size of one set's block in the allocation
+ *  sets - the allocation itself. Each set's block is laid out as
+ *  		E tags, followed by E words of per line policy metadata,
+ *  		followed by the per set policy state, followed by E valid 
+ *  		bytes (padded to a multiple of 8 bytes). It is mapped 
+ *  		without reserving memory, so a set takes no memory until it
+ *  		is first written.
+ *  touched - a bit per set, set once a block is placed in the set
+ *  clock - a logical access counter. Policies that order lines by
+ *  		time stamp them with ++clock. 
+ *  nextUse - the time of the next access to the block being accessed,
+ *  		for the optimal policy
+ *  write - what stores do, see writePolicy
+ *  writebacks - # of dirty lines written back on eviction
+ *  bytesRead, bytesWritten - memory traffic below the cache
+ *  bufferLines, bufferMasks, buffered - the write buffer, oldest line
+ *  		first. Bit k of a line's mask is set once the k-th 1/64 of 
+ *  		the line (or byte k, for lines shorter than 64 bytes) has been
+ *  		written.
+ *  splitLines - 1 if accesses that span several lines access each line
+ *  splitAccesses - # of accesses that were split
+ *  extraLines - # of line accesses splitting added
+ *  prefetch - the prefetcher in front of the cache, or NULL
+ *  prefetches - # of lines prefetched into the cache
+ *  prefetchUseful - # of prefetched lines a demand access hit
+ *  prefetchUseless - # of prefetched lines evicted before any use
+ *  prefetchEvictions - # of valid lines evicted by prefetches
+ *  pollution - # of demand misses on lines a prefetch had evicted
+ *  tlb - the TLBs that translate the cache's accesses, or NULL
+ *  intervals - the log of per window statistics, or NULL
+ *  classify - the classifier of the cache's misses, or NULL
+ */
+typedef struct cache{
+	int s;
+	int E;
+	int b;
+	const replacementPolicy* policy;
+	setScanner scan;
+	int stateWords;
+	size_t setBytes;
+	unsigned char* sets;
+	unsigned long long* touched;
+	unsigned long long clock;
+	unsigned long long nextUse;
+	writePolicy write;
+	unsigned long long writebacks;
+	unsigned long long bytesRead;
+	unsigned long long bytesWritten;
+	unsigned long long bufferLines[WRITE_BUFFER_LINES];
+	unsigned long long bufferMasks[WRITE_BUFFER_LINES];
+	int buffered;
+	int splitLines;
+	unsigned long long splitAccesses;
+	unsigned long long extraLines;
+	prefetcher* prefetch;
+	unsigned long long prefetches;
+	unsigned long long prefetchUseful;
+	unsigned long long prefetchUseless;
+	unsigned long long prefetchEvictions;
+	unsigned long long pollution;
+	tlb* tlb;
+	intervalLog* intervals;
+	classifier* classify;
+} cache;
+
+/* Returns the E tags of cache set index */
+static inline unsigned long long* setTags(cache* cache, unsigned long long index){
+	return (unsigned long long*) (cache->sets + index * cache->setBytes);
+}
+
+/* Returns the E policy metadata words of cache set index */
+static inline unsigned long long* setMeta(cache* cache, unsigned long long index){
+	return setTags(cache, index) + cache->E;
+}
+
+/* Returns the policy state words of cache set index */
+static inline unsigned long long* setState(cache* cache, unsigned long long index){
+	return setMeta(cache, index) + cache->E;
+}
+
+/* Returns the E valid bytes of cache set index */
+static inline unsigned char* setValid(cache* cache, unsigned long long index){
+	return (unsigned char*) (setState(cache, index) + cache->stateWords);
+}
+
+/*
+ * Marks cache set index as touched. Workers of a sharded run may touch
+ * sets whose bits share a word, so the bit is set atomically, but only
+ * the first time.
+ */
+static inline void touchSet(cache* cache, unsigned long long index){
+	unsigned long long* word = &cache->touched[index / 64];
+	unsigned long long bit = 1ULL << (index % 64);
+	if(!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit)){
+		__atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * A replacement policy. Each policy keeps one metadata word per line
+ * (setMeta) and a few words of state per set (setState), both inside
+ * the set's block.
+ *  onHit - called when way of set index hits
+ *  onFill - called when a new block is placed in way of set index
+ *  victim - returns the way to evict from set index, which is full
+ */
+struct replacementPolicy{
+	const char* name;
+	void (*onHit)(cache* cache, unsigned long long index, int way);
+	void (*onFill)(cache* cache, unsigned long long index, int way);
+	int (*victim)(cache* cache, unsigned long long index);
+};
+
+/* What an access did: hit, missed into an invalid line, or missed and
+ * evicted a valid block */
+typedef enum accessOutcome{
+	ACCESS_HIT,
+	ACCESS_MISS,
+	ACCESS_EVICT
+} accessOutcome;
+
+/* Returns a mask with the low count bits set */
+static inline unsigned long long lowBits(int count){
+	return (count >= 64) ? ~0ULL : (1ULL << count) - 1;
+}
+
+/*
+ * This method takes as an argument an address, s, E, and b
+ * and returns the tag for that address. 
+ */
+static inline unsigned long long getTagBits(unsigned long long address,int s, int E, int b){
+	/* If we have s index bits, b offset bits, and our addresses are 
+	 * 64 bits long, then we must have 64 - (b+s) tag bits. Also, 
+	 * recall from class that these are the top 64 - (b+s) bits. 
+	 * Shifting right by b+s bits places them in the low bits and
+	 * fills the rest with zeros, so no mask is needed. A shift by the
+	 * full width is undefined, so there are no tag bits in that case.
+	 */
+	if(b + s >= 64){
+		return 0;
+	}
+	return address >> (b + s);
+}
+
+/*
+ * Given a 64 bit address and s,E,b this method returns
+ * the index of the corresponding cache set. 
+ */
+static inline unsigned long long getIndexBits(unsigned long long address, int s, int E, int b){
+	/* We know our index bits are s long, so our mask is s 1's. */
+	unsigned long long mask = (1ULL << s) - 1;
+
+	/* We shift right to remove the offset bits, and mask away the 
+	 * index bits, as desired. */
+	return (address >> b) & mask;
+}
+
+/*
+ * This method looks for tag in cache set index. It returns the way
+ * holding tag, or -1 if the set does not hold it, in which case
+ * *invalid is set to the set's first invalid way, or -1 if it is full.
+ * It leaves the replacement policy alone, so lookups may call it.
+ */
+static inline int findWay(cache* cache, unsigned long long index, 
+							unsigned long long tag, int* invalid){
+	int E = cache->E;
+	unsigned long long* tags = setTags(cache, index);
+	unsigned char* valid = setValid(cache, index);
+	int invalidIndex = -1;
+
+	if(cache->scan != NULL){
+		/* Compare up to 64 ways at a time, and take the victim from 
+		 * the lowest set bit of the invalid mask */
+		for(int first = 0; first < E; first += 64){
+			int count = (E - first < 64) ? E - first : 64;
+			unsigned long long invalidMask;
+			int way = cache->scan(tags + first, valid + first, count, tag, 
+								  &invalidMask);
+			if(way >= 0){
+				return first + way;
+			}
+			if(invalidIndex < 0 && invalidMask != 0){
+				invalidIndex = first + __builtin_ctzll(invalidMask);
+			}
+		}
+	} else {
+		/* In a single pass over the set we look for our data, and 
+		 * remember the first invalid line in case we miss. */
+		for(int j = 0; j < E; j++){
+			if(valid[j]){
+				/* if tag matches and data is valid */ 
+				if(tags[j] == tag){
+					return j;
+				}
+			} else if(invalidIndex < 0){
+				invalidIndex = j;
+			}
+		}
+	}
+	*invalid = invalidIndex;
+	return -1;
+}
+
+/*
+ * This method returns the way a fill of set index should use, given
+ * the invalid way findWay found: that way if there is one, and 
+ * otherwise the one the replacement policy evicts. Policies such as
+ * SRRIP and random update their state as they choose, so only fills
+ * may call it.
+ */
+static inline int fillWay(cache* cache, unsigned long long index, int invalid){
+	return (invalid >= 0) ? invalid : cache->policy->victim(cache, index);
+}
+
+/*
+ * This method returns the address of the first byte of the block with
+ * the given tag in cache set index. 
+ */
+static inline unsigned long long blockAddress(cache* cache, unsigned long long tag,
+											  unsigned long long index){
+	int shift = cache->s + cache->b;
+	unsigned long long high = (shift >= 64) ? 0 : tag << shift;
+	return high | (index << cache->b);
+}
+
+/*
+ * findPolicy - Returns the replacement policy called name, or NULL if
+ * there is none.
+ */
+const replacementPolicy* findPolicy(const char* name);
+
+/*
+ * optimalPolicy - Returns Bélády's optimal policy, which evicts the line
+ * accessed again farthest in the future. It is not found by name since
+ * it only works if cache->nextUse holds the time of the next access to
+ * the block before every access.
+ */
+const replacementPolicy* optimalPolicy(void);
+
+/*
+ * makeCache - Creates an empty cache with 2^s sets of E lines of 2^b
+ * bytes, replaced by policy, or by LRU if policy is NULL. Returns NULL
+ * if the cache cannot be allocated.
+ */
+cache* makeCache(int s, int E, int b, const replacementPolicy* policy);
+
+/*
+ * cacheAccessBlock - Accesses the block holding address, filling it on
+ * a miss. Sets *outcome and returns the way holding the block.
+ */
+int cacheAccessBlock(cache* cache, unsigned long long address,
+					 accessOutcome* outcome);
+
+/*
+ * accessCache - cacheAccessBlock for the simulator, which adds the
+ * outcome to the counters and names it in *accessCacheInfo.
+ */
+int accessCache(cache* cache, unsigned long long address,
+				unsigned long long* evict, unsigned long long* hits,
+				unsigned long long* misses, char** accessCacheInfo);
+
+/*
+ * cacheStoreBlock - Stores size bytes at address as the cache's write
+ * policy says. Sets *outcome.
+ */
+void cacheStoreBlock(cache* cache, unsigned long long address,
+					 unsigned int size, accessOutcome* outcome);
+
+/*
+ * storeCache - cacheStoreBlock with the counters and string of
+ * accessCache.
+ */
+void storeCache(cache* cache, unsigned long long address, unsigned int size,
+				unsigned long long* evict, unsigned long long* hits,
+				unsigned long long* misses, char** accessCacheInfo);
+
+/*
+ * cacheLookup - Returns 1 and touches the block if address is cached,
+ * and returns 0 without filling it otherwise.
+ */
+int cacheLookup(cache* cache, unsigned long long address);
+
+/*
+ * cacheFill - Places the block holding address, which must not be
+ * cached. Returns 1 and sets *victimAddress if that evicted a block.
+ */
+int cacheFill(cache* cache, unsigned long long address,
+			  unsigned long long* victimAddress);
+
+/*
+ * cacheInvalidate - Removes the block holding address. Returns 1 if it
+ * was cached.
+ */
+int cacheInvalidate(cache* cache, unsigned long long address);
+
+/*
+ * runPrefetcher - Shows the cache's prefetcher a demand access and 
+ * prefetches what it asks for.
+ */
+void runPrefetcher(cache* cache, unsigned long long address, int miss,
+				   int prefetchedHit);
+
+/*
+ * unusedPrefetches - Returns the # of prefetched blocks never used.
+ */
+unsigned long long unusedPrefetches(cache* cache);
+
+/*
+ * flushWrites - Empties the write buffer into memory.
+ */
+void flushWrites(cache* cache);
+
+/*
+ * dirtyLines - Returns the # of dirty blocks in the cache.
+ */
+unsigned long long dirtyLines(cache* cache);
+
+/*
+ * touchedSets - Returns the number of sets any block was placed in.
+ */
+unsigned long long touchedSets(cache* cache);
+
+/*
+ * freeCache - Frees everything makeCache allocated.
+ */
+void freeCache(cache* cache);
+
+#endif /* CACHECORE_TOOLS_H */
@@ -1,250 +1,1765 @@
 #include "cache.h"
+#include "cachecore.h"
+#include "trace.h"
+#include "stackdist.h"
+#include "shards.h"
+#include "nextuse.h"
+#include "regions.h"
+#include "prefetch.h"
+#include "intervals.h"
+#include "classify.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <math.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
 #include <time.h>
-#include<sys/time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+/*
+ * This method makes a cache like makeCache, but since the simulator 
+ * cannot go on without it, exits if it cannot be allocated. 
+ */
+static cache* makeCacheOrExit(int s, int E, int b, const replacementPolicy* policy){
+	cache* c = makeCache(s, E, b, policy);
+	if(c == NULL){
+		printf("Cache allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	return c;
+}
+
+/*
+ * This method closes reader like traceClose, but exits if the trace 
+ * was cut short because its decompressor failed, rather than report
+ * results for part of it.
+ */
+static void closeTraceOrExit(traceReader* reader){
+	if(traceClose(reader) != 0){
+		printf("Read failed: the trace could not be decompressed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Number of TLB levels, the L1 DTLB and the L2 STLB */
+#define TLB_LEVELS 2
+
+/*
+ * A TLB level is a cache whose blocks are pages: 2^s sets of E entries
+ * with b the page bits, so each entry maps one page.
+ *  entries, ways - the level's size as given on the command line
+ */
+typedef struct tlbLevel{
+	cache* cache;
+	int entries;
+	int ways;
+	unsigned long long hits;
+	unsigned long long misses;
+} tlbLevel;
+
+/*
+ * Translation lookaside buffers that see the same accesses as the data
+ * cache. A miss in the last level walks the page table. 
+ */
+struct tlb{
+	tlbLevel levels[TLB_LEVELS];
+	int count;
+	int pageBits;
+	unsigned long long walks;
+};
+
+/*
+ * This method parses a TLB spec of the form entries/ways for the DTLB,
+ * optionally followed by ,entries/ways for the STLB and by :4k, :2m or
+ * :1g for the page size (4k if none is given), e.g. 64/4,1536/12:2m. 
+ */
+tlb* makeTLB(char* spec){
+	tlb* t = (tlb*) calloc(1, sizeof(tlb));
+	if(t == NULL){
+		printf("TLB allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	t->pageBits = 12;
+	char* page = strchr(spec, ':');
+	if(page != NULL){
+		if(strcmp(page + 1, "4k") == 0){
+			t->pageBits = 12;
+		} else if(strcmp(page + 1, "2m") == 0){
+			t->pageBits = 21;
+		} else if(strcmp(page + 1, "1g") == 0){
+			t->pageBits = 30;
+		} else {
+			printf("page sizes are 4k, 2m or 1g: %s\n", page + 1);
+			exit(1);
+		}
+	}
+
+	char* p = spec;
+	while(t->count < TLB_LEVELS && p != NULL && *p != '\0' && *p != ':'){
+		tlbLevel* level = &t->levels[t->count];
+		int parsed = sscanf(p, "%d/%d", &level->entries, &level->ways);
+		int sets = (parsed == 2 && level->ways > 0) ? level->entries / level->ways : 0;
+		if(parsed != 2 || sets < 1 || level->entries % level->ways != 0 ||
+				(sets & (sets - 1)) != 0){
+			printf("TLB levels look like entries/ways with a power of two "
+				   "number of sets, e.g. 64/4,1536/12:2m: %s\n", spec);
+			exit(1);
+		}
+		level->cache = makeCacheOrExit(__builtin_ctz(sets), level->ways, t->pageBits, NULL);
+		t->count++;
+		p = strchr(p, ',');
+		if(p != NULL){
+			p++;
+		}
+	}
+	if(t->count == 0){
+		printf("TLB levels look like entries/ways, e.g. 64/4,1536/12:2m: %s\n", spec);
+		exit(1);
+	}
+	return t;
+}
+
+/*
+ * This method translates address. Each level is looked up in turn 
+ * until one hits, and the levels that missed are then filled. If all
+ * of them missed the page table is walked. 
+ */
+static void tlbAccess(tlb* t, unsigned long long address){
+	int k = 0;
+	while(k < t->count){
+		if(cacheLookup(t->levels[k].cache, address)){
+			t->levels[k].hits++;
+			break;
+		}
+		t->levels[k].misses++;
+		k++;
+	}
+	if(k == t->count){
+		t->walks++;
+	}
+	for(int j = k - 1; j >= 0; j--){
+		unsigned long long victim;
+		cacheFill(t->levels[j].cache, address, &victim);
+	}
+}
+
+/*
+ * This method prints each TLB level's hits and misses and the number
+ * of page walks, and frees the TLB. 
+ */
+void reportTLB(tlb* t){
+	static const char* names[TLB_LEVELS] = { "DTLB", "STLB" };
+	const char* page = (t->pageBits == 12) ? "4k" : (t->pageBits == 21) ? "2m" : "1g";
+	for(int i = 0; i < t->count; i++){
+		tlbLevel* level = &t->levels[i];
+		printf("%s entries:%d ways:%d page:%s hits:%llu misses:%llu\n",
+				names[i], level->entries, level->ways, page, 
+				level->hits, level->misses);
+		freeCache(level->cache);
+	}
+	printf("page_walks:%llu\n", t->walks);
+	free(t);
+}
+
+/*
+ * This method simulates one access of type 'L', 'S' or 'M' to size 
+ * bytes at address, updating the counters like accessCache. If verbose 
+ * is 1 it prints the outcome, and if regions is not NULL it attributes
+ * the outcome to the region and set of address. 
+ */
+static void simulateAccess(cache* cache, char type, unsigned long long address,
+							unsigned int size, unsigned long long* evicts, 
+							unsigned long long* hits, unsigned long long* misses,
+							int verbose, regionStats* regions){
+	/* We initialize our two documentation strings to be empty */ 
+	char* accessCacheInfo = "";	
+	char* modifyInfo = "";
+
+	/* Remember the counters so we can attribute what changed */
+	unsigned long long hitsBefore = *hits;
+	unsigned long long missesBefore = *misses;
+	unsigned long long evictsBefore = *evicts;
+	unsigned long long usefulBefore = cache->prefetchUseful;
+
+	/* Based on parsed type, we perform corresponding operation. The
+	 * reader only hands us loads, stores and modifies. */ 
+	switch(type){
+		/* If we are modifying cache, we will read and then write. We note that
+		 * we always get a cachehit on the write. Therefore we increment the hit
+		 * and perform one cache access. With a write policy the write is a
+		 * real store, which still hits, but may dirty the block or go to memory. */ 
+		case 'M':
+			if(cache->write != WRITE_NONE){
+				accessCache(cache, address, evicts, hits, misses, &accessCacheInfo);
+				storeCache(cache, address, size, evicts, hits, misses, &modifyInfo);
+				break;
+			}
+			*hits += 1;
+			modifyInfo = "hit";
+		/* Cases S and L are equivalent, unless we follow a write policy */ 
+		case 'S':
+			if(type == 'S' && cache->write != WRITE_NONE){
+				storeCache(cache, address, size, evicts, hits, misses, &accessCacheInfo);
+				break;
+			}
+		case 'L':
+			// Access the cache, updating counters and accessCacheInfo
+			accessCache(cache, address, evicts, hits, misses, &accessCacheInfo);
+			break;
+		/* Note that we are definitely taking advantage of "fall through" in our switch statement.*/ 
+		default:
+			break;	
+	}
+
+	/* Every access is translated before the cache sees it */
+	if(cache->tlb != NULL){
+		tlbAccess(cache->tlb, address);
+	}
+
+	/* The shadow cache sees every access too, and sorts out its misses */
+	if(cache->classify != NULL){
+		int allocate = !(type == 'S' && (cache->write == WRITE_THROUGH 
+										|| cache->write == WRITE_BUFFERED));
+		classifyAccess(cache->classify, address >> cache->b,
+					   getIndexBits(address, cache->s, cache->E, cache->b),
+					   *misses != missesBefore, allocate);
+	}
+
+	/* The prefetcher sees every demand access once it is done */
+	if(cache->prefetch != NULL){
+		runPrefetcher(cache, address, *misses != missesBefore, 
+					  cache->prefetchUseful != usefulBefore);
+	}
+
+	/* If we our verbose flag is set to 1, we print additional information about
+	 * each instruction. Namely, the sequence of hits, misses, or evictions. 
+	 * This information is stored in accessCacheInfo as well as modifyInfo strings. 
+	 * If we are modifying, then modifyInfo adds an additional hit at the end, to account
+	 * for the second operation in modify, which is a write. 
+	 */
+	if(verbose == 1){
+		printf("%c %llx,%u %s %s\n", type, address, size, accessCacheInfo, modifyInfo);
+	}
+	if(regions != NULL){
+		regionRecord(regions, address, 
+					 getIndexBits(address, cache->s, cache->E, cache->b),
+					 *hits - hitsBefore, *misses - missesBefore, 
+					 *evicts - evictsBefore);
+	}
+}
+
+/*
+ * This method takes as arguments the cache and a traceFile, 
+ * and sets counters evicts, hits, and misses to reflect the 
+ * evictions, hits, and misses when we run our cache on the traceFile.   
+ * If regions is not NULL, every hit, miss and eviction is also 
+ * attributed to the region and set of the access that caused it.
+ * If the cache splits accesses, an access that spans several lines 
+ * accesses each of them. 
+ */
+void runCache(char* traceFile, cache* cache, 
+										unsigned long long* evicts, unsigned long long* hits, 
+										unsigned long long* misses, int verbose, 
+										regionStats* regions){ 
+	
+	/* We map our tracefile into memory and decode it a batch at a time */ 	
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+	
+	/* 
+	 * Parses file batch by batch and calls corresponding cache operation.  
+	 */
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	
+	/* While we have not reached end of our file, we parse */
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			char type = batch[i].op;
+			unsigned long long address = batch[i].address;
+			unsigned int size = batch[i].size;
+
+			/* Most accesses stay inside one line, and unless we split
+			 * accesses every access counts as a single one */
+			unsigned long long first = address >> cache->b;
+			unsigned long long last = (address + size - 1) >> cache->b;
+			if(!cache->splitLines || size <= 1 || first == last 
+			   || address + size - 1 < address){
+				simulateAccess(cache, type, address, size, evicts, hits, 
+							   misses, verbose, regions);
+			} else {
+				/* Otherwise every line the access touches is accessed in 
+				 * turn, each with the bytes of the access inside it */
+				cache->splitAccesses += 1;
+				cache->extraLines += last - first;
+				unsigned long long end = address + size;
+				for(unsigned long long line = first; line <= last; line++){
+					unsigned long long lineStart = line << cache->b;
+					unsigned long long pieceStart = (line == first) ? address : lineStart;
+					unsigned long long pieceEnd = (line == last) ? end 
+												: lineStart + (1ULL << cache->b);
+					simulateAccess(cache, type, pieceStart, 
+								   (unsigned int) (pieceEnd - pieceStart), evicts, 
+								   hits, misses, verbose, regions);
+				}
+			}
+
+			/* Each record is one access of its window, however it was split */
+			if(cache->intervals != NULL){
+				intervalAccess(cache->intervals, *hits, *misses, *evicts);
+			}
+		}
+	}
+	
+	closeTraceOrExit(reader);
+	flushWrites(cache);
+	if(cache->intervals != NULL){
+		closeIntervalLog(cache->intervals, *hits, *misses, *evicts);
+		cache->intervals = NULL;
+	}
+	return;
+}
+
+/* Returns the current time in seconds, for measuring throughput */
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * This method decodes traceFile twice, once with the fscanf loop that
+ * runCache used to use and once with the mapped trace reader, and 
+ * prints how many records per second each of them decodes. Both count
+ * only L, S and M records so the numbers are comparable.
+ */
+void benchmarkTrace(char* traceFile){
+	FILE* stream = fopen(traceFile, "r");
+	if(stream == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+	char type = 0;
+	unsigned long long address = 0;
+	unsigned int size = 0;
+	unsigned long long records = 0;
+	unsigned long long checksum = 0;
+
+	double start = now();
+	while(fscanf(stream, " %c %llx,%u", &type, &address, &size) != EOF){
+		if(type == 'L' || type == 'S' || type == 'M'){
+			records++;
+			checksum += address;
+		}
+	}
+	double elapsed = now() - start;
+	fclose(stream);
+	printf("fscanf: %llu records in %.3f s (%.0f records/sec)\n",
+				records, elapsed, records / elapsed);
+
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	unsigned long long mappedRecords = 0;
+	unsigned long long mappedChecksum = 0;
+
+	start = now();
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			mappedChecksum += batch[i].address;
+		}
+		mappedRecords += n;
+	}
+	elapsed = now() - start;
+	closeTraceOrExit(reader);
+	printf("mmap:   %llu records in %.3f s (%.0f records/sec)\n",
+				mappedRecords, elapsed, mappedRecords / elapsed);
+
+	if(records != mappedRecords || checksum != mappedChecksum){
+		printf("warning: the two readers disagree about the trace\n");
+	}
+}
+
+/* getopt_long value of --batch, which has no short form */
+#define BATCH_OPTION 256
+
+/* Number of records per batch handed to the sweep workers */
+#define SWEEP_BATCH (16 * TRACE_BATCH)
+
+/* A cache geometry: # of index bits, lines per set, # of offset bits */
+typedef struct geometry{
+	int s;
+	int E;
+	int b;
+} geometry;
+
+/* One cache of a sweep along with its counters */
+typedef struct sweepConfig{
+	geometry geometry;
+	cache* cache;
+	unsigned long long evicts;
+	unsigned long long hits;
+	unsigned long long misses;
+} sweepConfig;
+
+/*
+ * State shared between the parsing thread and the sweep workers. 
+ * The parser decodes into one of the two batches while the workers
+ * simulate the other, and everybody meets at the barrier in between.
+ */
+typedef struct sweep{
+	sweepConfig* configs;
+	int count;
+	int workers;
+	traceRecord* batches[2];
+	size_t sizes[2];
+	pthread_barrier_t barrier;
+} sweep;
+
+/* A sweep worker, which simulates configs id, id + workers, ... */
+typedef struct sweepWorker{
+	sweep* sweep;
+	int id;
+} sweepWorker;
+
+/*
+ * This method parses a list of values such as "1,2,4" or "4-8" (or a 
+ * mix of both, "1,4-6") into values, and returns how many it found. 
+ * Malformed lists print an error and exit.
+ */
+int parseValues(char* list, int* values, int max){
+	int count = 0;
+	char* item = list;
+	while(*item != '\0'){
+		char* rest;
+		int low = strtol(item, &rest, 10);
+		int high = low;
+		if(rest == item){
+			printf("bad geometry value: %s\n", list);
+			exit(1);
+		}
+		if(*rest == '-'){
+			item = rest + 1;
+			high = strtol(item, &rest, 10);
+			if(rest == item || high < low){
+				printf("bad geometry range: %s\n", list);
+				exit(1);
+			}
+		}
+		for(int v = low; v <= high; v++){
+			if(count == max){
+				printf("too many geometry values: %s\n", list);
+				exit(1);
+			}
+			values[count++] = v;
+		}
+		item = (*rest == ',') ? rest + 1 : rest;
+		if(*rest != ',' && *rest != '\0'){
+			printf("bad geometry value: %s\n", list);
+			exit(1);
+		}
+	}
+	return count;
+}
+
+/*
+ * This method expands a geometry spec of the form s/E/b, where each
+ * part is a list accepted by parseValues, into every combination of 
+ * its values and appends them to *geometries.
+ */
+void parseGeometries(char* spec, geometry** geometries, int* count){
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", spec);
+	char* parts[3];
+	parts[0] = strtok(copy, "/");
+	parts[1] = strtok(NULL, "/");
+	parts[2] = strtok(NULL, "/");
+	if(parts[2] == NULL || strtok(NULL, "/") != NULL){
+		printf("geometries look like s/E/b, e.g. 4-8/1,2,4/6: %s\n", spec);
+		exit(1);
+	}
+
+	int sValues[64], EValues[64], bValues[64];
+	int sCount = parseValues(parts[0], sValues, 64);
+	int ECount = parseValues(parts[1], EValues, 64);
+	int bCount = parseValues(parts[2], bValues, 64);
+
+	*geometries = (geometry*) realloc(*geometries, 
+					sizeof(geometry) * (*count + sCount * ECount * bCount));
+	for(int i = 0; i < sCount; i++){
+		for(int j = 0; j < ECount; j++){
+			for(int k = 0; k < bCount; k++){
+				geometry g = { sValues[i], EValues[j], bValues[k] };
+				if(g.s < 0 || g.b < 0 || g.E < 1 || g.s + g.b > 64){
+					printf("bad geometry: s=%d E=%d b=%d\n", g.s, g.E, g.b);
+					exit(1);
+				}
+				(*geometries)[(*count)++] = g;
+			}
+		}
+	}
+}
+
+/*
+ * This method applies a single trace record to cache. Modifies are a
+ * read followed by a write that always hits, just like in runCache.
+ */
+static inline void simulateRecord(cache* cache, const traceRecord* record, 
+									unsigned long long* evicts, unsigned long long* hits, 
+									unsigned long long* misses){
+	char* accessCacheInfo;
+	if(record->op == 'M'){
+		*hits += 1;
+	}
+	accessCache(cache, record->address, evicts, hits, misses, &accessCacheInfo);
+}
+
+/*
+ * Body of a sweep worker thread. Each round it waits at the barrier 
+ * for the parser to publish a batch, then runs that batch through 
+ * each of its caches. An empty batch marks the end of the trace.
+ */
+void* sweepWorkerMain(void* arg){
+	sweepWorker* worker = (sweepWorker*) arg;
+	sweep* sweep = worker->sweep;
+	int current = 0;
+
+	while(1){
+		pthread_barrier_wait(&sweep->barrier);
+		traceRecord* batch = sweep->batches[current];
+		size_t n = sweep->sizes[current];
+		if(n == 0){
+			break;
+		}
+		for(int i = worker->id; i < sweep->count; i += sweep->workers){
+			sweepConfig* config = &sweep->configs[i];
+			for(size_t r = 0; r < n; r++){
+				simulateRecord(config->cache, &batch[r], 
+								&config->evicts, &config->hits, &config->misses);
+			}
+		}
+		current ^= 1;
+	}
+	return NULL;
+}
+
+/*
+ * This method simulates every geometry in geometries on traceFile
+ * while reading the trace only once. The calling thread parses the 
+ * trace and worker threads simulate the caches, and a summary line
+ * is printed for each geometry in the order they were given.
+ */
+void runSweep(char* traceFile, geometry* geometries, int count, int workers,
+										const replacementPolicy* policy){
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+	if(workers > count){
+		workers = count;
+	}
+
+	sweep sweep;
+	sweep.count = count;
+	sweep.workers = workers;
+	sweep.configs = (sweepConfig*) calloc(count, sizeof(sweepConfig));
+	for(int i = 0; i < count; i++){
+		sweep.configs[i].geometry = geometries[i];
+		sweep.configs[i].cache = makeCacheOrExit(geometries[i].s, geometries[i].E, 
+											geometries[i].b, policy);
+	}
+	sweep.batches[0] = (traceRecord*) malloc(sizeof(traceRecord) * SWEEP_BATCH);
+	sweep.batches[1] = (traceRecord*) malloc(sizeof(traceRecord) * SWEEP_BATCH);
+	pthread_barrier_init(&sweep.barrier, NULL, workers + 1);
+
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * workers);
+	sweepWorker* workerArgs = (sweepWorker*) malloc(sizeof(sweepWorker) * workers);
+	for(int i = 0; i < workers; i++){
+		workerArgs[i].sweep = &sweep;
+		workerArgs[i].id = i;
+		pthread_create(&threads[i], NULL, sweepWorkerMain, &workerArgs[i]);
+	}
+
+	/* Parse the next batch while the workers simulate the current one */
+	int current = 0;
+	sweep.sizes[current] = traceRead(reader, sweep.batches[current], SWEEP_BATCH);
+	while(1){
+		pthread_barrier_wait(&sweep.barrier);
+		if(sweep.sizes[current] == 0){
+			break;
+		}
+		current ^= 1;
+		sweep.sizes[current] = traceRead(reader, sweep.batches[current], SWEEP_BATCH);
+	}
+
+	for(int i = 0; i < workers; i++){
+		pthread_join(threads[i], NULL);
+	}
+	closeTraceOrExit(reader);
+
+	for(int i = 0; i < count; i++){
+		sweepConfig* config = &sweep.configs[i];
+		printf("s:%d E:%d b:%d hits:%llu misses:%llu evictions:%llu\n",
+				config->geometry.s, config->geometry.E, config->geometry.b,
+				config->hits, config->misses, config->evicts);
+		freeCache(config->cache);
+	}
+
+	pthread_barrier_destroy(&sweep.barrier);
+	free(sweep.batches[0]);
+	free(sweep.batches[1]);
+	free(sweep.configs);
+	free(threads);
+	free(workerArgs);
+}
+
+/*
+ * State shared by the workers of a batch run. Workers take the next
+ * trace off the list under the lock, read it once through a cache of
+ * every geometry, and leave the counts in results, count per trace.
+ */
+typedef struct batchRun{
+	char** traces;
+	int traceCount;
+	geometry* geometries;
+	int count;
+	const replacementPolicy* policy;
+	sweepConfig* results;
+	int* failed;
+	int next;
+	pthread_mutex_t lock;
+} batchRun;
+
+/*
+ * Body of a batch worker thread, which simulates traces until the list
+ * runs out. Traces that cannot be read are marked as failed.
+ */
+void* batchWorkerMain(void* arg){
+	batchRun* run = (batchRun*) arg;
+	traceRecord batch[TRACE_BATCH];
+
+	while(1){
+		pthread_mutex_lock(&run->lock);
+		int t = run->next++;
+		pthread_mutex_unlock(&run->lock);
+		if(t >= run->traceCount){
+			break;
+		}
+
+		traceReader* reader = traceOpen(run->traces[t]);
+		if(reader == NULL){
+			run->failed[t] = 1;
+			continue;
+		}
+		sweepConfig* configs = &run->results[(size_t) t * run->count];
+		for(int i = 0; i < run->count; i++){
+			configs[i].geometry = run->geometries[i];
+			configs[i].cache = makeCacheOrExit(run->geometries[i].s, run->geometries[i].E,
+										run->geometries[i].b, run->policy);
+		}
+		size_t n;
+		while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+			for(int i = 0; i < run->count; i++){
+				for(size_t r = 0; r < n; r++){
+					simulateRecord(configs[i].cache, &batch[r],
+									&configs[i].evicts, &configs[i].hits, &configs[i].misses);
+				}
+			}
+		}
+		if(traceClose(reader) != 0){
+			run->failed[t] = 1;
+		}
+		for(int i = 0; i < run->count; i++){
+			freeCache(configs[i].cache);
+			configs[i].cache = NULL;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * This method reads the list of trace files in listFile, one per line
+ * with blank lines and lines starting with # skipped, and returns how
+ * many it found in *traces.
+ */
+int readTraceList(char* listFile, char*** traces){
+	FILE* list = fopen(listFile, "r");
+	if(list == NULL){
+		printf("Could not read %s\n", listFile);
+		exit(EXIT_FAILURE);
+	}
+	int count = 0;
+	int size = 0;
+	char* line = NULL;
+	size_t length = 0;
+	*traces = NULL;
+	while(getline(&line, &length, list) != -1){
+		char* path = line;
+		while(isspace((unsigned char) *path)){
+			path++;
+		}
+		char* end = path + strlen(path);
+		while(end > path && isspace((unsigned char) end[-1])){
+			*--end = '\0';
+		}
+		if(*path == '\0' || *path == '#'){
+			continue;
+		}
+		if(count == size){
+			size = size ? 2 * size : 64;
+			*traces = (char**) realloc(*traces, sizeof(char*) * size);
+		}
+		(*traces)[count++] = strdup(path);
+	}
+	free(line);
+	fclose(list);
+	return count;
+}
+
+/*
+ * This method simulates every trace listed in listFile on every 
+ * geometry in geometries, spreading the traces over a pool of workers
+ * threads, and writes one CSV row per trace and geometry, in the order
+ * of the list, to outputFile or to stdout if outputFile is NULL. 
+ * Unlike printSummary it leaves .cachesim_results alone. Traces that
+ * cannot be read are reported on stderr and make it return 1.
+ */
+int runBatch(char* listFile, geometry* geometries, int count, int workers,
+				const replacementPolicy* policy, char* outputFile){
+	batchRun run;
+	run.traceCount = readTraceList(listFile, &run.traces);
+	run.geometries = geometries;
+	run.count = count;
+	run.policy = policy;
+	run.results = (sweepConfig*) calloc((size_t) run.traceCount * count + 1, 
+										sizeof(sweepConfig));
+	run.failed = (int*) calloc(run.traceCount + 1, sizeof(int));
+	run.next = 0;
+	pthread_mutex_init(&run.lock, NULL);
+	if(run.results == NULL || run.failed == NULL){
+		printf("Batch allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	if(workers > run.traceCount){
+		workers = run.traceCount;
+	}
+
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * (workers + 1));
+	for(int i = 0; i < workers; i++){
+		pthread_create(&threads[i], NULL, batchWorkerMain, &run);
+	}
+	for(int i = 0; i < workers; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	FILE* out = stdout;
+	if(outputFile != NULL){
+		out = fopen(outputFile, "w");
+		if(out == NULL){
+			printf("Could not write %s\n", outputFile);
+			exit(EXIT_FAILURE);
+		}
+	}
+	int status = 0;
+	fprintf(out, "trace,s,E,b,hits,misses,evictions\n");
+	for(int t = 0; t < run.traceCount; t++){
+		if(run.failed[t]){
+			fprintf(stderr, "Read failed: %s\n", run.traces[t]);
+			status = 1;
+			continue;
+		}
+		for(int i = 0; i < count; i++){
+			sweepConfig* config = &run.results[(size_t) t * count + i];
+			fprintf(out, "%s,%d,%d,%d,%llu,%llu,%llu\n", run.traces[t],
+					config->geometry.s, config->geometry.E, config->geometry.b,
+					config->hits, config->misses, config->evicts);
+		}
+	}
+	if(out != stdout){
+		fclose(out);
+	}
+
+	pthread_mutex_destroy(&run.lock);
+	for(int t = 0; t < run.traceCount; t++){
+		free(run.traces[t]);
+	}
+	free(run.traces);
+	free(run.results);
+	free(run.failed);
+	free(threads);
+	return status;
+}
+
+/*
+ * A batch of addresses for a set-sharded run, sorted by shard. Shard
+ * i's addresses are addresses[starts[i]] up to addresses[starts[i + 1]].
+ */
+typedef struct shardBatch{
+	unsigned long long* addresses;
+	size_t* starts;
+} shardBatch;
+
+/*
+ * State shared between the parsing thread and the shard workers of a
+ * set-sharded run. Every shard owns a contiguous range of sets and 
+ * simulates them through its own view of the cache, which shares the
+ * sets but has its own clock. Since sets never interact and every set
+ * sees its accesses in trace order, the result is that of a serial run.
+ */
+typedef struct shardedRun{
+	cache* views;
+	int shards;
+	unsigned long long* evicts;
+	unsigned long long* hits;
+	unsigned long long* misses;
+	shardBatch batches[2];
+	pthread_barrier_t barrier;
+} shardedRun;
+
+/* A shard worker, which simulates shard id */
+typedef struct shardWorker{
+	shardedRun* run;
+	int id;
+} shardWorker;
+
+/*
+ * Body of a shard worker thread. Each round it waits at the barrier 
+ * for the parser to publish a batch, then runs its share of the batch
+ * through its view of the cache. An empty batch marks the end.
+ */
+void* shardWorkerMain(void* arg){
+	shardWorker* worker = (shardWorker*) arg;
+	shardedRun* run = worker->run;
+	int id = worker->id;
+	int current = 0;
+
+	while(1){
+		pthread_barrier_wait(&run->barrier);
+		shardBatch* batch = &run->batches[current];
+		if(batch->starts[run->shards] == 0){
+			break;
+		}
+		char* accessCacheInfo;
+		for(size_t i = batch->starts[id]; i < batch->starts[id + 1]; i++){
+			accessCache(&run->views[id], batch->addresses[i], &run->evicts[id],
+						&run->hits[id], &run->misses[id], &accessCacheInfo);
+		}
+		current ^= 1;
+	}
+	return NULL;
+}
+
+/*
+ * This method reads the next batch of records and sorts their 
+ * addresses into batch by shard, with a counting sort. It returns 
+ * the number of modifies in the batch, whose write halves always hit.
+ */
+int fillShardBatch(traceReader* reader, traceRecord* records, shardBatch* batch,
+					int shards, int s, int b){
+	size_t n = traceRead(reader, records, SWEEP_BATCH);
+	size_t* starts = batch->starts;
+	memset(starts, 0, sizeof(size_t) * (shards + 1));
+	int modifies = 0;
+
+	/* Shard i owns sets [i * 2^s / shards, (i + 1) * 2^s / shards) */
+	for(size_t i = 0; i < n; i++){
+		unsigned long long index = getIndexBits(records[i].address, s, 0, b);
+		starts[((index * shards) >> s) + 1]++;
+		modifies += records[i].op == 'M';
+	}
+	for(int i = 0; i < shards; i++){
+		starts[i + 1] += starts[i];
+	}
+
+	/* Place the addresses, using starts as cursors for a moment */
+	for(size_t i = 0; i < n; i++){
+		unsigned long long index = getIndexBits(records[i].address, s, 0, b);
+		batch->addresses[starts[(index * shards) >> s]++] = records[i].address;
+	}
+	for(int i = shards; i > 0; i--){
+		starts[i] = starts[i - 1];
+	}
+	starts[0] = 0;
+	return modifies;
+}
+
+/*
+ * This method does the same as runCache, but with the cache's sets
+ * split between worker threads. The calling thread parses the trace 
+ * and sorts each batch by shard while the workers simulate the 
+ * previous batch. The counters of every shard are added together at 
+ * the end, and match those of a serial run exactly.
+ */
+void runCacheSharded(char* traceFile, cache* cache, unsigned long long* evicts, 
+					unsigned long long* hits, unsigned long long* misses, int workers){
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Every shard needs at least one set */
+	int shards = workers;
+	if((unsigned long long) shards > (1ULL << cache->s)){
+		shards = 1 << cache->s;
+	}
+
+	shardedRun run;
+	run.shards = shards;
+	run.views = (struct cache*) malloc(sizeof(*cache) * shards);
+	run.evicts = (unsigned long long*) calloc(shards, sizeof(unsigned long long));
+	run.hits = (unsigned long long*) calloc(shards, sizeof(unsigned long long));
+	run.misses = (unsigned long long*) calloc(shards, sizeof(unsigned long long));
+	for(int i = 0; i < shards; i++){
+		run.views[i] = *cache;
+	}
+	for(int i = 0; i < 2; i++){
+		run.batches[i].addresses = (unsigned long long*) 
+					malloc(sizeof(unsigned long long) * SWEEP_BATCH);
+		run.batches[i].starts = (size_t*) malloc(sizeof(size_t) * (shards + 1));
+	}
+	traceRecord* records = (traceRecord*) malloc(sizeof(traceRecord) * SWEEP_BATCH);
+	pthread_barrier_init(&run.barrier, NULL, shards + 1);
+
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * shards);
+	shardWorker* workerArgs = (shardWorker*) malloc(sizeof(shardWorker) * shards);
+	for(int i = 0; i < shards; i++){
+		workerArgs[i].run = &run;
+		workerArgs[i].id = i;
+		pthread_create(&threads[i], NULL, shardWorkerMain, &workerArgs[i]);
+	}
+
+	/* Sort the next batch while the workers simulate the current one */
+	int current = 0;
+	*hits += fillShardBatch(reader, records, &run.batches[current], shards, 
+							cache->s, cache->b);
+	while(1){
+		pthread_barrier_wait(&run.barrier);
+		if(run.batches[current].starts[shards] == 0){
+			break;
+		}
+		current ^= 1;
+		*hits += fillShardBatch(reader, records, &run.batches[current], shards,
+								cache->s, cache->b);
+	}
+
+	for(int i = 0; i < shards; i++){
+		pthread_join(threads[i], NULL);
+		*evicts += run.evicts[i];
+		*hits += run.hits[i];
+		*misses += run.misses[i];
+	}
+	closeTraceOrExit(reader);
+
+	pthread_barrier_destroy(&run.barrier);
+	for(int i = 0; i < 2; i++){
+		free(run.batches[i].addresses);
+		free(run.batches[i].starts);
+	}
+	free(records);
+	free(run.views);
+	free(run.evicts);
+	free(run.hits);
+	free(run.misses);
+	free(threads);
+	free(workerArgs);
+}
+
+/*
+ * This method runs a stack distance analysis of traceFile for caches
+ * with 2^s sets and 2^b byte blocks, and prints a summary line for
+ * every associativity from 1 to maxE, followed by a line for each
+ * fully associative cache with the same number of lines. The results
+ * are exactly those of simulating each of those LRU caches.
+ */
+void runStackDistance(char* traceFile, int s, int b, int maxE){
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+
+	stackDist* sd = makeStackDist(s, maxE);
+	/* The write half of a modify always hits, whatever the geometry */
+	unsigned long long modifies = 0;
+
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			unsigned long long address = batch[i].address;
+			unsigned long long line = getTagBits(address, 0, 0, b);
+			stackDistAccess(sd, line, getIndexBits(address, s, 0, b));
+			modifies += batch[i].op == 'M';
+		}
+	}
+	closeTraceOrExit(reader);
+
+	unsigned long long hits, misses, evictions;
+	for(int E = 1; E <= maxE; E++){
+		stackDistResults(sd, E, &hits, &misses, &evictions);
+		printf("s:%d E:%d b:%d hits:%llu misses:%llu evictions:%llu\n",
+				s, E, b, hits + modifies, misses, evictions);
+	}
+	for(int E = 1; E <= maxE; E++){
+		stackDistFullResults(sd, E, &hits, &misses, &evictions);
+		printf("s:0 E:%llu b:%d hits:%llu misses:%llu evictions:%llu\n",
+				(unsigned long long) E << s, b, hits + modifies, misses, evictions);
+	}
+	freeStackDist(sd);
+}
+
+/*
+ * This method estimates the miss ratio curve of fully associative LRU
+ * caches with 2^b byte lines on traceFile, sampling at most budget 
+ * lines at a time, and prints the estimate with its standard error for
+ * every cache size of 2^k lines up to twice the trace's estimated 
+ * footprint.
+ */
+void runShards(char* traceFile, int b, int budget){
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
 
-#include <string.h>
-#include <ctype.h>
-#include <getopt.h>
+	shards* sampler = makeShards(budget, 1);
+	/* The write half of a modify always hits, as in runStackDistance */
+	unsigned long long records = 0;
+	unsigned long long modifies = 0;
 
-/* 
- * Cacheline struct. Implements necessary metadata for cacheLine. 
- * Metadata:
- *  validBit - 0 if cacheline is invalid, 1 if cacheLine is valid
- *  tag - integer reflecting which block is stored in cacheLine
- *  timeStamp - a timeval object capturing the system time when 
- *  			the cacheLine was last accessed. This allows us
- *  			to identify the least recently used (LRU) cacheline. 
- */
-typedef struct cacheLine{
-	int validBit;
-	int tag;
-	struct timeval timeStamp;
-} cacheLine;
-
-/*
- * This method takes as input three parameters:
- * 	s: the number of set bits 
- * 	E: the number of lines per cacheset
- * 	b: the number of offset bits
- *
- * We construct a cache with S = 2^s cache sets, each of 
- * which hold E cacheLines. The cache is represented as a
- * two dimensional matrix of cacheLines.
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			shardsAccess(sampler, getTagBits(batch[i].address, 0, 0, b));
+			modifies += batch[i].op == 'M';
+		}
+		records += n;
+	}
+	closeTraceOrExit(reader);
+
+	double footprint = shardsDistinct(sampler);
+	double accesses = records + modifies;
+	for(int k = 0; k + b < 64; k++){
+		double error;
+		double ratio = shardsMissRatio(sampler, k, &error);
+		printf("lines:%llu bytes:%llu miss_ratio:%.4f error:%.4f\n",
+				1ULL << k, 1ULL << (k + b), ratio * records / accesses, 
+				error * records / accesses);
+		if((double) (1ULL << k) >= 2 * footprint){
+			break;
+		}
+	}
+	printf("accesses:%.0f footprint_lines:%.0f\n", accesses, footprint);
+	freeShards(sampler);
+}
+
+/*
+ * This method replays traceFile on a cache with 2^s sets of E lines of
+ * 2^b bytes under Bélády's optimal replacement, and sets evicts, hits
+ * and misses like runCache does without any options. A first pass
+ * builds the trace's next-use index, so traceFile must be a file that
+ * can be read twice.
  */
-cacheLine*** makeCache(int s, int E, int b) {
-	/* Allocates space for cacheSets */
-	cacheLine*** cache = (cacheLine***) malloc(sizeof(cacheLine**)*pow(2,s));
-	
-	/* For each cache set in our cache */ 
-	for(int i = 0; i < pow(2,s); i++){ 
+void runOptimal(char* traceFile, int s, int E, int b, 
+				unsigned long long* evicts, unsigned long long* hits, 
+				unsigned long long* misses){
+	nextUse* nu = buildNextUse(traceFile, b);
+	traceReader* reader = traceOpen(traceFile);
+	if(nu == NULL || reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+	const unsigned int* distances = nextUseDistances(nu);
+	unsigned long long count = nextUseCount(nu);
+	cache* cache = makeCacheOrExit(s, E, b, optimalPolicy());
+
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	unsigned long long position = 0;
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0 && position < count){
+		for(size_t i = 0; i < n && position < count; i++, position++){
+			unsigned int distance = distances[position];
+			cache->nextUse = (distance == NEXT_USE_NEVER) ? ~0ULL : position + distance;
+			simulateRecord(cache, &batch[i], evicts, hits, misses);
+		}
+	}
+	closeTraceOrExit(reader);
+	freeCache(cache);
+	freeNextUse(nu);
+}
+
+/*
+ * This method returns whether path names a regular file, which unlike
+ * stdin, a FIFO or a process substitution can be read more than once.
+ */
+static int isRegularFile(char* path){
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0){
+		return 0;
+	}
+	struct stat st;
+	int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	close(fd);
+	return regular;
+}
+
+/* How the levels of a cache hierarchy share blocks */
+typedef enum inclusion{
+	NINE,		/* neither inclusive nor exclusive */
+	INCLUSIVE,	/* each level holds every block the levels above it hold */
+	EXCLUSIVE	/* each block is held by at most one level */
+} inclusion;
+
+/* One level of a cache hierarchy along with its counters */
+typedef struct level{
+	geometry geometry;
+	cache* cache;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+} level;
+
+/*
+ * A cache hierarchy. levels[0] is the L1, and a miss in levels[i] 
+ * falls through to levels[i + 1]. backInvalidations counts the blocks
+ * an inclusive hierarchy removed from upper levels because a lower 
+ * level evicted them.
+ */
+typedef struct hierarchy{
+	level* levels;
+	int count;
+	inclusion inclusion;
+	unsigned long long backInvalidations;
+} hierarchy;
 
-		/* Allocate memory for E cache lines in each set */ 
-		cache[i] = (cacheLine**) malloc(sizeof(cacheLine*)*E);
+/*
+ * This method removes the block at address, which level j just 
+ * evicted, from every level above j. Upper levels may use smaller 
+ * blocks, so every one of their blocks it covers is removed. 
+ */
+void backInvalidate(hierarchy* h, int j, unsigned long long address){
+	unsigned long long size = 1ULL << h->levels[j].geometry.b;
+	for(int i = 0; i < j; i++){
+		unsigned long long step = 1ULL << h->levels[i].geometry.b;
+		for(unsigned long long a = address; a < address + size; a += step){
+			h->backInvalidations += cacheInvalidate(h->levels[i].cache, a);
+		}
+	}
+}
 
-		/* Initialize metadata for each cacheLine */  
-		for(int j = 0; j < E; j++){
-			cache[i][j] = (cacheLine*) malloc(sizeof(cacheLine));
-			cache[i][j]->validBit = 0; // set valid bit to 0 
-			cache[i][j]->tag = 0; // initialize tag to 0
-			// Set time stamp to current system time
-			gettimeofday(&cache[i][j]->timeStamp, NULL);
+/*
+ * This method places address into level j of an exclusive hierarchy.
+ * Whatever level j evicts to make room moves down to level j + 1, and
+ * only leaves the hierarchy when the last level evicts it.
+ */
+void insertExclusive(hierarchy* h, int j, unsigned long long address){
+	unsigned long long victim;
+	if(cacheFill(h->levels[j].cache, address, &victim)){
+		h->levels[j].evictions++;
+		if(j + 1 < h->count){
+			insertExclusive(h, j + 1, victim);
 		}
-  	}
-	return cache;
+	}
 }
 
 /*
- * This method takes as an argument an address, s, E, and b
- * and returns the tag for that address. 
+ * This method performs one access to a cache hierarchy. We look the 
+ * address up level by level until some level hits, and then bring the
+ * block into the levels that missed as the inclusion policy says.
  */
-int getTagBits(unsigned long long address,int s, int E, int b){
-	/* If we have s index bits, b offset bits, and our addresses are 
-	 * 64 bits long, then we must have 64 - (b+s) tag bits. Also, 
-	 * recall from class that these are the top 64 - (b+s) bits. 
-	 * We create a mask of b+s 0's followed by 64-(b+s) 1's. 
-	 */
-	int mask = ~((~0) << (64 -(b+s)));
+void accessHierarchy(hierarchy* h, unsigned long long address){
+	int k = 0;
+	while(k < h->count){
+		if(cacheLookup(h->levels[k].cache, address)){
+			h->levels[k].hits++;
+			break;
+		}
+		h->levels[k].misses++;
+		k++;
+	}
+	if(k == 0){
+		return;
+	}
 
-	/*  We shift our address to the right by b+s bits, placing the tag bits 
-	 *  in the lower 64 - (b+s) bits. Then we mask these away using our tag bits. 
-	 */
-	return (address >> (b + s)) & mask;
+	if(h->inclusion == EXCLUSIVE){
+		/* The block moves up to the L1, out of the level that had it */
+		if(k < h->count){
+			cacheInvalidate(h->levels[k].cache, address);
+		}
+		insertExclusive(h, 0, address);
+		return;
+	}
+
+	/* Fill the lower levels first, so that back-invalidations caused by
+	 * their evictions cannot remove the block we just placed above */
+	for(int j = k - 1; j >= 0; j--){
+		unsigned long long victim;
+		if(cacheFill(h->levels[j].cache, address, &victim)){
+			h->levels[j].evictions++;
+			if(h->inclusion == INCLUSIVE && j > 0){
+				backInvalidate(h, j, victim);
+			}
+		}
+	}
 }
 
 /*
- * Given a 64 bit address and s,E,b this method returns
- * the index of the corresponding cache set. 
+ * This method runs traceFile through a hierarchy with the given levels
+ * and prints each level's hits, misses and evictions, followed by a 
+ * combined summary: hits in any level, misses that went all the way to
+ * memory, and evictions from any level. 
  */
-int getIndexBits(unsigned long long address, int s, int E, int b){
-	/* We know our index bits are s long, so our mask is s 1's. */
+void runHierarchy(char* traceFile, geometry* geometries, int count, 
+						inclusion inclusion, const replacementPolicy* policy){
+	/* Back-invalidation and moving blocks between levels both need the
+	 * lower levels' blocks to be at least as large as the upper ones' */
+	for(int i = 1; i < count; i++){
+		if(geometries[i].b < geometries[i - 1].b || 
+				(inclusion == EXCLUSIVE && geometries[i].b != geometries[i - 1].b)){
+			printf("lower levels need %s block sizes\n", 
+					inclusion == EXCLUSIVE ? "the same" : "at least as large");
+			exit(1);
+		}
+	}
 
-	/* In order to obtain the index bits, we have to create a mask
-	 * that is s bits long */ 	
-	int mask = ~((~0) << s);
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		printf("Read failed");
+		exit(EXIT_FAILURE);
+	}
+
+	hierarchy h;
+	h.count = count;
+	h.inclusion = inclusion;
+	h.backInvalidations = 0;
+	h.levels = (level*) calloc(count, sizeof(level));
+	for(int i = 0; i < count; i++){
+		h.levels[i].geometry = geometries[i];
+		h.levels[i].cache = makeCacheOrExit(geometries[i].s, geometries[i].E, 
+										geometries[i].b, policy);
+	}
+
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			accessHierarchy(&h, batch[i].address);
+			/* The write half of a modify always hits in the L1 */
+			if(batch[i].op == 'M'){
+				h.levels[0].hits++;
+			}
+		}
+	}
+	closeTraceOrExit(reader);
 
-	/* We shift right to remove the offset bits, and mask away the 
-	 * index bits, as desired. */
-	return (address >> b) & mask;
+	unsigned long long hits = 0;
+	unsigned long long evictions = 0;
+	for(int i = 0; i < count; i++){
+		level* l = &h.levels[i];
+		printf("L%d s:%d E:%d b:%d hits:%llu misses:%llu evictions:%llu\n",
+				i + 1, l->geometry.s, l->geometry.E, l->geometry.b,
+				l->hits, l->misses, l->evictions);
+		hits += l->hits;
+		evictions += l->evictions;
+		freeCache(l->cache);
+	}
+	printf("back-invalidations:%llu\n", h.backInvalidations);
+	printSummary(hits, h.levels[count - 1].misses, evictions);
+	free(h.levels);
 }
 
+/* A line's valid byte marks MESI states as follows: invalid is 0, 
+ * shared is 1, exclusive adds LINE_EXCLUSIVE and modified adds 
+ * LINE_EXCLUSIVE and LINE_DIRTY. */
+#define LINE_EXCLUSIVE 8
+
+/* Cores are tracked in 64-bit masks */
+#define MAX_CORES 64
+
+/* Number of falsely shared lines listed by name */
+#define FALSE_SHARING_TOP 10
+
+/* How the traces of the cores are interleaved */
+typedef enum interleave{
+	BY_ORDER,	/* one record from each core in turn */
+	BY_TIME		/* by timestamp, and by core for equal timestamps */
+} interleave;
+
 /*
- * This method takes as input the following parameters:
- * 		address: the address of the block in memory we are caching
- * 		s: # of index bits
- * 		E: # of cache lines per set
- * 		b: # of offset bits 
- *		evict: a pointer to a counter of the evictions so far
- *		hits: a pointer to a counter of the hits so far
- *		misses: a pointer to a counter of the misses so far
- *  	cache: 2d array of cachelines
- *  	accessCacheinfo: a pointer to a string that we edit for verbosity. 
- * 
- * We noticed that reading, writing were equivalent, therefore this 
- * serves as a generic cache access for both. We place the block in 
- * the cache, and update evict, hits, misses counters as well as 
- * accessCacheinfo string accordingly. 
- */ 
-void accessCache(unsigned long long address, int s,  int E, int b, 
-											int* evict, 
-											int* hits, 
-											int* misses,
-											cacheLine*** cache,
-											char** accessCacheInfo){
-	// Obtain tag and index from address
-	int tag = getTagBits(address, s, E, b);
-	int index = getIndexBits(address, s, E, b);
-	
-	// Grab corresponding cacheset in cache
-	cacheLine** set = cache[index];
-	
-	/* First, we look to see if our data is already in the cache */
-	for(int j = 0; j < E; j++){
-		/* if tag matches and data is valid */ 
-		if((set[j]->tag == tag) && (set[j]->validBit == 1)){
-			// set timestamp, increment hits
-			gettimeofday(&set[j]->timeStamp, NULL);
-			*hits += 1;
-			*accessCacheInfo = "hit";
-			return;
+ * What the coherence model knows about one line, whichever core 
+ * holds it. key is the line address plus one, so that 0 marks an empty
+ * table entry.
+ *  sharers - the cores whose L1 holds the line, as a directory would 
+ *  		record them
+ *  lost - the cores an invalidation took the line from, which have not
+ *  		missed on it since
+ *  writers - the cores that have written the line
+ *  written - the 1/64ths of the line (or bytes, for shorter lines) 
+ *  		that have been written
+ *  owners - which core first wrote each 1/64th, kept only once a 
+ *  		second core writes the line
+ *  overlap - 1 once two cores have written the same part of the line
+ *  invalidations - # of copies of the line invalidated
+ */
+typedef struct lineState{
+	unsigned long long key;
+	unsigned long long sharers;
+	unsigned long long lost;
+	unsigned long long writers;
+	unsigned long long written;
+	unsigned char* owners;
+	int overlap;
+	unsigned long long invalidations;
+} lineState;
+
+/*
+ * Private L1s kept coherent with MESI. With a bus every transaction is
+ * snooped by every other core, and with a directory only the cores 
+ * recorded as sharers are sent messages.
+ */
+typedef struct coherence{
+	int cores;
+	int directory;
+	cache** caches;
+	unsigned long long* hits;
+	unsigned long long* misses;
+	unsigned long long* evictions;
+	lineState* table;
+	unsigned long long tableSize;
+	unsigned long long tableUsed;
+	unsigned long long invalidations;
+	unsigned long long coherenceMisses;
+	unsigned long long upgrades;
+	unsigned long long writebacks;
+	unsigned long long transactions;
+	unsigned long long messages;
+} coherence;
+
+/* Hashes a line address into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashLineState(unsigned long long line,
+											   unsigned long long mask){
+	return ((line * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table slot for line, or an empty one if it is not there */
+static unsigned long long lineSlot(coherence* co, unsigned long long line){
+	unsigned long long mask = co->tableSize - 1;
+	unsigned long long i = hashLineState(line, mask);
+	while(co->table[i].key != line + 1 && co->table[i].key != 0){
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/* Returns the state of line, adding it to the table if needed */
+static lineState* findLineState(coherence* co, unsigned long long line){
+	unsigned long long i = lineSlot(co, line);
+	if(co->table[i].key != 0){
+		return &co->table[i];
+	}
+
+	/* Keep the table at most half full so probes stay short */
+	if(2 * (co->tableUsed + 1) > co->tableSize){
+		lineState* old = co->table;
+		unsigned long long oldSize = co->tableSize;
+		co->tableSize *= 2;
+		co->table = (lineState*) calloc(co->tableSize, sizeof(lineState));
+		if(co->table == NULL){
+			printf("Coherence table allocation failed");
+			exit(EXIT_FAILURE);
+		}
+		for(unsigned long long j = 0; j < oldSize; j++){
+			if(old[j].key != 0){
+				co->table[lineSlot(co, old[j].key - 1)] = old[j];
+			}
 		}
+		free(old);
+		i = lineSlot(co, line);
 	}
-	
-	/* Second, we look to see if there is any invalid data we can overwrite. 
-	 * Concurrently, we also locate the least recently used cacheline. */
-	int LRUindex = 0;
- 
-	for(int j = 0; j < E; j++){
-		/* If we find invalid data, we replace it with our new block */ 
-		if(set[j]->validBit == 0){
-			/* set timestamp, new tag, validbit becomes 1, and increment
-			 * misses (but not evictions). */
-			gettimeofday(&set[j]->timeStamp,NULL);
-			set[j]->tag = tag;
-			set[j]->validBit = 1;
-			*misses += 1;
-			*accessCacheInfo = "miss";
-			return;
-		}
-		/* Concurrently, we locate the least recently used block */ 
-		if((double)(set[LRUindex]->timeStamp.tv_usec - set[j]->timeStamp.tv_usec) > 0){
-			LRUindex = j;
-		}
-	}
-	/* Finally, if our data was not in the cache, and there was no invalid data 
-	 * to overwrite, we evict the least recently used data, which we found above. */ 
-	set[LRUindex]->tag = tag; // update tag
-	gettimeofday(&set[LRUindex]->timeStamp,NULL); // update time
-	*evict += 1; // increment eviction counter
-	*misses += 1; // increment miss counter
-
-	*accessCacheInfo = "miss eviction";
+	co->table[i].key = line + 1;
+	co->tableUsed++;
+	return &co->table[i];
+}
 
-	return;
+/* Returns the valid byte of the block holding address in c, or NULL */
+static unsigned char* lineFlags(cache* c, unsigned long long address){
+	unsigned long long tag = getTagBits(address, c->s, c->E, c->b);
+	unsigned long long index = getIndexBits(address, c->s, c->E, c->b);
+	int invalid = -1;
+	int way = findWay(c, index, tag, &invalid);
+	return (way >= 0) ? &setValid(c, index)[way] : NULL;
+}
+
+/* Sends a transaction for line to the cores in targets, counting the 
+ * snoops or directory messages it costs */
+static void coherenceTransaction(coherence* co, unsigned long long targets){
+	co->transactions++;
+	co->messages += co->directory ? __builtin_popcountll(targets) 
+								  : (unsigned long long) co->cores - 1;
 }
 
 /*
- * This method frees all allocated space for the cache.  
+ * This method takes the line at address away from every core in 
+ * targets. Modified copies are written back first. 
  */
-void freeCache(cacheLine*** cache, int s, int E){
-	for(int i = 0; i < pow(2,s); i++){
-		for(int j = 0; j < E; j++){
-			free(cache[i][j]); // free cacheline
+static void invalidateOthers(coherence* co, lineState* ls, 
+							 unsigned long long address, unsigned long long targets){
+	for(; targets != 0; targets &= targets - 1){
+		int k = __builtin_ctzll(targets);
+		unsigned char* flags = lineFlags(co->caches[k], address);
+		if(flags == NULL){
+			continue;
+		}
+		if(*flags & LINE_DIRTY){
+			co->writebacks++;
 		}
-		free(cache[i]); // free each cache set
+		*flags = 0;
+		ls->lost |= 1ULL << k;
+		ls->invalidations++;
+		co->invalidations++;
 	}
-	free(cache); // free cache pointer
+	ls->sharers &= ~targets;
 }
 
+/*
+ * This method records a write of size bytes at address by core, and 
+ * notices when two cores write the same part of the line. 
+ */
+static void recordWrite(lineState* ls, int core, unsigned long long address,
+						unsigned int size, int b){
+	unsigned long long lineBytes = 1ULL << b;
+	unsigned long long offset = address & (lineBytes - 1);
+	unsigned long long end = (offset + size < lineBytes) ? offset + size : lineBytes;
+	int chunkShift = (b > 6) ? b - 6 : 0;
+	int first = offset >> chunkShift;
+	int last = (size == 0) ? first : (int) ((end - 1) >> chunkShift);
+	unsigned long long mask = lowBits(last + 1) & ~lowBits(first);
+	unsigned long long bit = 1ULL << core;
 
+	/* Until a second core writes the line every written part is the
+	 * first writer's, so per part owners are only needed after that */
+	if(ls->owners == NULL && ls->writers != 0 && ls->writers != bit){
+		ls->owners = (unsigned char*) malloc(64);
+		memset(ls->owners, 0xff, 64);
+		int firstWriter = __builtin_ctzll(ls->writers);
+		for(unsigned long long m = ls->written; m != 0; m &= m - 1){
+			ls->owners[__builtin_ctzll(m)] = firstWriter;
+		}
+	}
+	if(ls->owners != NULL){
+		for(unsigned long long m = mask; m != 0; m &= m - 1){
+			unsigned char* owner = &ls->owners[__builtin_ctzll(m)];
+			if(*owner == 0xff){
+				*owner = core;
+			} else if(*owner != core){
+				ls->overlap = 1;
+			}
+		}
+	}
+	ls->writers |= bit;
+	ls->written |= mask;
+}
 
 /*
- * This method takes as arguments s,E,b, the cache, and a traceFile, 
- * and sets counters evicts, hits, and misses to reflect the 
- * evictions, hits, and misses when we run our cache on the traceFile.   
+ * This method performs a load (write 0) or a store (write 1) by core 
+ * of size bytes at address, keeping every L1 coherent. 
  */
-void runCache(int s, int E, int b, char* traceFile, cacheLine*** cache, 
-										int* evicts, int* hits, int* misses, 
-																int verbose){ 
-	
-	/* We create a stream to read our tracefile line by line */ 	
-	FILE *stream;
-	
-	stream = fopen(traceFile, "r");
-	if(stream == NULL){
-		printf("Read failed");
-		exit(EXIT_FAILURE);
+void coherentAccess(coherence* co, int core, unsigned long long address,
+					unsigned int size, int write){
+	cache* c = co->caches[core];
+	unsigned long long tag = getTagBits(address, c->s, c->E, c->b);
+	unsigned long long index = getIndexBits(address, c->s, c->E, c->b);
+	unsigned long long bit = 1ULL << core;
+	lineState* ls = findLineState(co, address >> c->b);
+	unsigned long long others = ls->sharers & ~bit;
+
+	int invalid = -1;
+	int way = findWay(c, index, tag, &invalid);
+	unsigned char* valid = setValid(c, index);
+	if(way >= 0){
+		c->policy->onHit(c, index, way);
+		co->hits[core]++;
+		if(write){
+			/* A shared copy has to be upgraded by invalidating the
+			 * others, an exclusive one becomes modified silently */
+			if(!(valid[way] & LINE_EXCLUSIVE)){
+				co->upgrades++;
+				coherenceTransaction(co, others);
+				invalidateOthers(co, ls, address, others);
+			}
+			valid[way] |= LINE_EXCLUSIVE | LINE_DIRTY;
+			recordWrite(ls, core, address, size, c->b);
+		}
+		return;
 	}
-	
-	/* 
-	 * Parses file line by line and calls corresponding cache operation.  
-	 */
-	char type = 0;
-	unsigned long long address = 0;
-	int size = 0;
-	
-	/* While we have not reached end of our file, we parse */
-	while(fscanf(stream, " %c %llx,%x", &type, &address, &size) != EOF){
-		/* We initialize our two documentation strings to be empty */ 
-		char* accessCacheInfo = "";	
-		char* modifyInfo = "";
-
-		/* Based on parsed type, we perform corresponding operation */ 
-		switch(type){
-			/* If we are modifying cache, we will read and then write. We note that
-			 * we always get a cachehit on the write. Therefore we increment the hit
-			 * and perform one cache access. */ 
-			case 'M':
-				*hits += 1;
-				modifyInfo = "hit";
-			/* Cases S and L are equivalent */ 
-			case 'S':
-			case 'L':
-				// Access the cache, updating counters and accessCacheInfo
-				accessCache(address, s, E, b, evicts, hits, misses, cache, &accessCacheInfo);
-				/* If we our verbose flag is set to 1, we print additional information about
-				 * each instruction. Namely, the sequence of hits, misses, or evictions. 
-				 * This information is stored in accessCacheInfo as well as modifyInfo strings. 
-				 * If we are modifying, then modifyInfo adds an additional hit at the end, to account
-				 * for the second operation in modify, which is a write. 
-				 */
-				if(verbose == 1){
-					printf("%c %llx,%x %s %s\n", type, address, size, accessCacheInfo, modifyInfo);
+
+	co->misses[core]++;
+	if(ls->lost & bit){
+		co->coherenceMisses++;
+		ls->lost &= ~bit;
+	}
+
+	/* A store reads the line for ownership, so every other copy goes.
+	 * A load only takes exclusivity away from the others, and a 
+	 * modified copy is written back on the way. */
+	coherenceTransaction(co, others);
+	if(write){
+		invalidateOthers(co, ls, address, others);
+	} else {
+		for(unsigned long long t = others; t != 0; t &= t - 1){
+			unsigned char* flags = lineFlags(co->caches[__builtin_ctzll(t)], address);
+			if(flags != NULL){
+				if(*flags & LINE_DIRTY){
+					co->writebacks++;
 				}
+				*flags = 1;
+			}
+		}
+	}
+
+	/* Make room, telling the directory the victim left this core */
+	int victim = fillWay(c, index, invalid);
+	if(valid[victim]){
+		co->evictions[core]++;
+		if(valid[victim] & LINE_DIRTY){
+			co->writebacks++;
+		}
+		unsigned long long victimLine = blockAddress(c, setTags(c, index)[victim], 
+													 index) >> c->b;
+		unsigned long long slot = lineSlot(co, victimLine);
+		co->table[slot].sharers &= ~bit;
+	}
+	setTags(c, index)[victim] = tag;
+	if(write){
+		valid[victim] = 1 | LINE_EXCLUSIVE | LINE_DIRTY;
+		recordWrite(ls, core, address, size, c->b);
+	} else {
+		valid[victim] = (ls->sharers & ~bit) ? 1 : 1 | LINE_EXCLUSIVE;
+	}
+	ls->sharers |= bit;
+	c->policy->onFill(c, index, victim);
+	touchSet(c, index);
+}
+
+/* Orders lines by how many copies of them were invalidated, most first */
+static int byInvalidations(const void* a, const void* b){
+	const lineState* x = *(const lineState* const*) a;
+	const lineState* y = *(const lineState* const*) b;
+	if(x->invalidations != y->invalidations){
+		return x->invalidations < y->invalidations ? 1 : -1;
+	}
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/*
+ * This method runs one trace per core through private L1s with the 
+ * given geometry, kept coherent with MESI over a bus, or a directory 
+ * if directory is 1. It prints each core's hits, misses and evictions,
+ * the coherence traffic, and the lines that are falsely shared: 
+ * written by several cores, but never in the same place. 
+ */
+void runCoherence(char** traceFiles, int cores, int s, int E, int b,
+				  const replacementPolicy* policy, interleave order, 
+				  int directory){
+	if(cores > MAX_CORES){
+		printf("at most %d cores are supported\n", MAX_CORES);
+		exit(1);
+	}
+
+	coherence co;
+	memset(&co, 0, sizeof(co));
+	co.cores = cores;
+	co.directory = directory;
+	co.caches = (cache**) malloc(sizeof(cache*) * cores);
+	co.hits = (unsigned long long*) calloc(cores, sizeof(unsigned long long));
+	co.misses = (unsigned long long*) calloc(cores, sizeof(unsigned long long));
+	co.evictions = (unsigned long long*) calloc(cores, sizeof(unsigned long long));
+	co.tableSize = 1024;
+	co.table = (lineState*) calloc(co.tableSize, sizeof(lineState));
+
+	/* Each core reads its trace a batch at a time */
+	traceReader** readers = (traceReader**) malloc(sizeof(traceReader*) * cores);
+	traceRecord* batches = (traceRecord*) malloc(sizeof(traceRecord) * TRACE_BATCH * cores);
+	size_t* counts = (size_t*) calloc(cores, sizeof(size_t));
+	size_t* cursors = (size_t*) calloc(cores, sizeof(size_t));
+	for(int i = 0; i < cores; i++){
+		co.caches[i] = makeCacheOrExit(s, E, b, policy);
+		readers[i] = traceOpen(traceFiles[i]);
+		if(readers[i] == NULL){
+			printf("Read failed");
+			exit(EXIT_FAILURE);
+		}
+	}
 
+	int core = 0;
+	while(1){
+		/* Refill the batches that ran out, and pick the next core */
+		int next = -1;
+		for(int k = 0; k < cores; k++){
+			int i = (order == BY_ORDER) ? (core + k) % cores : k;
+			if(cursors[i] == counts[i] && readers[i] != NULL){
+				counts[i] = traceRead(readers[i], batches + i * TRACE_BATCH, TRACE_BATCH);
+				cursors[i] = 0;
+				if(counts[i] == 0){
+					closeTraceOrExit(readers[i]);
+					readers[i] = NULL;
+				}
+			}
+			if(cursors[i] == counts[i]){
+				continue;
+			}
+			if(order == BY_ORDER){
+				next = i;
 				break;
-			/* Note that we are definitely taking advantage of "fall through" in our switch statement.*/ 
-			default:
-				break;	
+			}
+			if(next < 0 || batches[i * TRACE_BATCH + cursors[i]].time < 
+						   batches[next * TRACE_BATCH + cursors[next]].time){
+				next = i;
+			}
+		}
+		if(next < 0){
+			break;
 		}
+
+		traceRecord* record = &batches[next * TRACE_BATCH + cursors[next]++];
+		/* A modify is a load followed by a store, which then hits */
+		coherentAccess(&co, next, record->address, record->size, record->op == 'S');
+		if(record->op == 'M'){
+			coherentAccess(&co, next, record->address, record->size, 1);
+		}
+		core = (next + 1) % cores;
 	}
-	
-	fclose(stream);
-	return;
+
+	unsigned long long hits = 0, misses = 0, evictions = 0;
+	for(int i = 0; i < cores; i++){
+		printf("core %d hits:%llu misses:%llu evictions:%llu\n",
+				i, co.hits[i], co.misses[i], co.evictions[i]);
+		hits += co.hits[i];
+		misses += co.misses[i];
+		evictions += co.evictions[i];
+		freeCache(co.caches[i]);
+	}
+	printf("invalidations:%llu coherence_misses:%llu upgrades:%llu writebacks:%llu\n",
+			co.invalidations, co.coherenceMisses, co.upgrades, co.writebacks);
+	printf("%s:%llu %s:%llu\n", directory ? "directory_requests" : "bus_transactions",
+			co.transactions, directory ? "directory_messages" : "snoops", co.messages);
+
+	/* Falsely shared lines, the ones invalidated most often first */
+	lineState** shared = (lineState**) malloc(sizeof(lineState*) * (co.tableUsed + 1));
+	unsigned long long falseSharing = 0;
+	unsigned long long trueSharing = 0;
+	for(unsigned long long i = 0; i < co.tableSize; i++){
+		lineState* ls = &co.table[i];
+		if(ls->key == 0 || ls->owners == NULL){
+			continue;
+		}
+		if(ls->overlap){
+			trueSharing++;
+		} else {
+			shared[falseSharing++] = ls;
+		}
+	}
+	qsort(shared, falseSharing, sizeof(lineState*), byInvalidations);
+	printf("false_sharing_lines:%llu true_sharing_lines:%llu\n", falseSharing, trueSharing);
+	for(unsigned long long i = 0; i < falseSharing && i < FALSE_SHARING_TOP; i++){
+		printf("false sharing 0x%llx writers:%d invalidations:%llu\n",
+				(shared[i]->key - 1) << b, __builtin_popcountll(shared[i]->writers),
+				shared[i]->invalidations);
+	}
+	printSummary(hits, misses, evictions);
+
+	for(unsigned long long i = 0; i < co.tableSize; i++){
+		free(co.table[i].owners);
+	}
+	free(shared);
+	free(co.table);
+	free(co.caches);
+	free(co.hits);
+	free(co.misses);
+	free(co.evictions);
+	free(readers);
+	free(batches);
+	free(counts);
+	free(cursors);
+}
+
+/*
+ * This method writes the region and set attribution report to 
+ * outputFile, as JSON if its name ends in .json and as CSV otherwise,
+ * or as CSV to stdout if outputFile is NULL. 
+ */
+void writeRegions(regionStats* regions, char* outputFile){
+	if(outputFile == NULL){
+		regionWrite(regions, stdout, 0);
+		return;
+	}
+	FILE* out = fopen(outputFile, "w");
+	if(out == NULL){
+		printf("Could not write %s\n", outputFile);
+		exit(EXIT_FAILURE);
+	}
+	size_t length = strlen(outputFile);
+	int json = length >= 5 && strcmp(outputFile + length - 5, ".json") == 0;
+	regionWrite(regions, out, json);
+	fclose(out);
+}
+
+/*
+ * This method prints the help information for the -h flag. 
+ */
+static void printHelp(void){
+	printf("This function is a cache simulator. \n\
+	It takes the following flagged command line arguments:\n\
+		-s: # of index bits \n\
+ 		-E: # of lines per set\n\
+ 		-b: # of offset bits\n\
+ 		-t: tracefile (maybe .gz or .zst), or - for stdin, once per core\n\
+ 		-h: optional flag which prints help information\n\
+ 		-v: optional flag for more verbose output\n\
+ 		-B: optional flag which benchmarks the trace readers\n\
+ 		-g: optional s/E/b geometries to sweep, e.g. 4-8/1,2,4/6\n\
+ 		-j: optional # of worker threads for a sweep or a single cache\n\
+ 		-A: optional max E for an all-associativity stack distance analysis\n\
+ 		-m: optional sample budget for a SHARDS miss ratio curve estimate\n\
+ 		-L: optional s/E/b of a hierarchy level, once per level from the L1\n\
+ 		-H: optional hierarchy inclusion policy: nine, inclusive or exclusive\n\
+ 		-p: optional replacement policy: lru, fifo, random, plru, srrip, brrip, lfu\n\
+ 		-r: optional region bits for per region and per set attribution (12 = pages)\n\
+ 		-o: optional file for the attribution report (.json or .csv)\n\
+ 		-w: optional write policy: wb, wt or wtb, which also reports memory traffic\n\
+ 		-l: optional flag which splits accesses that span several lines\n\
+ 		-f: optional prefetcher: next, stride or stream\n\
+ 		-K: optional interleaving of per-core traces: order or time\n\
+ 		-M: optional coherence model for per-core traces: bus or dir\n\
+ 		-T: optional DTLB[,STLB] entries/ways and page size, e.g. 64/4,1536/12:2m\n\
+ 		-i: optional # of accesses per window for windowed statistics\n\
+ 		-I: optional CSV file for the windowed statistics (default stdout)\n\
+ 		-c: optional flag which classifies misses as compulsory, capacity or conflict\n\
+ 		-O: optional flag which also reports Belady's optimal replacement\n\
+ 		-P: optional flag which reports accesses/sec and peak memory use\n\
+ 		--batch: optional list of traces to simulate on -j workers, as CSV to -o\n\
+	Example usage includes: cachesim -s 1 -E 4 -b 10 -t t1.trace\n\
+	                        cachesim -g 0-10/1,2,4,8/4-6 -j 8 -t t1.trace\n\
+	                        cachesim -s 6 -A 32 -b 6 -t t1.trace\n\
+	                        cachesim --batch traces.list -g 6/1,8/6 -j 8 -o results.csv\n\
+	                        cachesim -L 6/8/6 -L 10/8/6 -H inclusive -t t1.trace\n\
+	                        cachesim -s 6 -E 8 -b 6 -t core0.trace -t core1.trace -K time\n\
+	                        valgrind --tool=lackey --trace-mem=yes --log-fd=3 prog 3>&1 >/dev/null | cachesim -s 6 -E 8 -b 6 -t -\n");
 }
 
 /*
@@ -252,33 +1767,171 @@ void runCache(int s, int E, int b, char* traceFile, cacheLine*** cache,
  * -s: # of index bits
  * -E: # of lines per set
  * -b: # of offset bits 
- * -t: tracefile
+ * -t: tracefile, or - to stream the trace from stdin. Given more than 
+ *     once, each trace is one core's, and the cores' private L1s are 
+ *     kept coherent with MESI. Traces may be gzip or zstd compressed
  * -h: optional flag which prints help information
  * -v: optional flag for more verbose output
+ * -B: optional flag which benchmarks the trace readers on the tracefile
+ * -g: optional geometry list s/E/b to sweep over instead of -s -E -b,
+ *     may be given more than once
+ * -j: optional # of worker threads for a sweep, or for a single cache
+ *     whose sets are then split between the threads
+ * -A: optional maximum associativity for a stack distance analysis,
+ *     which reports every E from 1 to the maximum at the given -s -b
+ * -m: optional sample budget, in lines, for a SHARDS estimate of the 
+ *     miss ratio curve of fully associative caches with 2^b byte lines,
+ *     which takes constant memory however big the trace
+ * -L: optional s/E/b geometry of a cache level, given once per level 
+ *     starting with the L1, to simulate a hierarchy
+ * -H: optional inclusion policy of the hierarchy: nine (the default), 
+ *     inclusive or exclusive
+ * -p: optional replacement policy: lru (the default), fifo, random,
+ *     plru, srrip, brrip or lfu
+ * -r: optional # of region bits, which attributes hits, misses and 
+ *     evictions to regions of 2^r bytes (12 for pages) and to sets
+ * -o: optional file for the -r report, JSON if it ends in .json and 
+ *     CSV otherwise (the default is CSV on stdout), or for the --batch CSV
+ * -w: optional write policy: wb (write-back, write-allocate), wt 
+ *     (write-through, no-write-allocate) or wtb (write-through with a
+ *     coalescing write buffer), which also reports memory traffic
+ * -l: optional flag which splits accesses that span several lines into
+ *     an access per line, and reports how many were split
+ * -f: optional prefetcher: next (next-line), stride (stride detector 
+ *     keyed by region) or stream (stream buffers), which also reports
+ *     how accurate and useful the prefetches were
+ * -K: optional interleaving of per-core traces: order (one record from
+ *     each core in turn, the default) or time (by the timestamp that 
+ *     may follow each record's size)
+ * -M: optional coherence model: bus (the default) or dir (directory)
+ * -T: optional TLBs to simulate alongside the cache, as DTLB entries/ways,
+ *     then optionally the STLB's, then optionally the page size, e.g. 
+ *     64/4,1536/12:2m (pages are 4k, 2m or 1g, and 4k by default)
+ * -i: optional # of accesses per window, which writes the hits, misses,
+ *     evictions and miss rate of every window as CSV
+ * -I: optional file for the -i windows (the default is stdout)
+ * -c: optional flag which classifies every miss as compulsory, capacity
+ *     or conflict, overall and for the sets with the most conflicts
+ * -O: optional flag which also replays the trace file under Bélády's
+ *     optimal replacement and reports its hits, misses and evictions,
+ *     and the share of the configured policy's misses it avoids. The
+ *     trace must be a regular file, and -w, -l and -f are not modelled
+ * -P: optional flag which reports how many accesses per second the 
+ *     simulation ran at, the peak resident set size and how many sets
+ *     were touched, last
+ * --batch: optional file listing one trace per line, each of which is
+ *     simulated on -s -E -b, or on every -g geometry, by a pool of -j
+ *     worker threads. The results go to -o, or stdout, as one CSV
+ *     instead of to .cachesim_results
+ *
+ * -v, -w, -l, -f, -T, -c, -r, -i, -O and -P follow every access of a
+ * single cache, so they are rejected together with --batch, several -t,
+ * -L, -A, -m or -g, and those modes are rejected together too.
  *
  * It creates the cache, runs the trace file, and outputs the results
  * to printSummary. 
  */ 
 int main(int argc, char** argv){
-	/* Set default values for v and h, as well as initializing
+	/* Set default values for v, as well as initializing
 	 * s,E,b, and the traceFile string */
 	int v = 0;
-	int h = 0;
-	int s,E,b;
+	int B = 0;
+	int s = 0, E = 0, b = 0;
+	int workers = 1;
+	int maxE = 0;
+	int budget = 0;
+	geometry* levels = NULL;
+	int levelCount = 0;
+	inclusion inclusion = NINE;
+	const replacementPolicy* policy = NULL;
+	int regionBits = -1;
+	char* outputFile = NULL;
+	writePolicy write = WRITE_NONE;
+	int l = 0;
+	char* prefetchKind = NULL;
+	char** traceFiles = NULL;
+	int traceCount = 0;
+	interleave order = BY_ORDER;
+	int directory = 0;
+	tlb* tlb = NULL;
+	unsigned long long period = 0;
+	char* intervalFile = NULL;
+	int classify = 0;
+	int P = 0;
+	int O = 0;
+	geometry* geometries = NULL;
+	int geometryCount = 0;
 
-	char *traceFile;
-	char c;
+	char* batchFile = NULL;
+	static struct option longOptions[] = {
+		{ "batch", required_argument, NULL, BATCH_OPTION },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	char *traceFile = NULL;
+	int c;
 
 	/* We use some code provided by professor to parse flagged
 	 * arguments */
-	while ((c = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+	while ((c = getopt_long(argc, argv, "hvlcPOBs:E:b:t:g:j:A:m:L:H:p:r:o:w:f:K:M:T:i:I:",
+							longOptions, NULL)) != -1) {
 		switch (c) {
-		case 'h':
-			h = 1;
+		case BATCH_OPTION:
+			batchFile = optarg;
 			break;
+		case 'h':
+			printHelp();
+			exit(0);
 		case 'v':
 			v = 1;
 			break;
+		case 'B':
+			B = 1;
+			break;
+		case 'l':
+			l = 1;
+			break;
+		case 'c':
+			classify = 1;
+			break;
+		case 'P':
+			P = 1;
+			break;
+		case 'O':
+			O = 1;
+			break;
+		case 'f':
+			prefetchKind = optarg;
+			break;
+		case 'K':
+			if(strcmp(optarg, "order") == 0){
+				order = BY_ORDER;
+			} else if(strcmp(optarg, "time") == 0){
+				order = BY_TIME;
+			} else {
+				printf("unknown interleaving: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'T':
+			tlb = makeTLB(optarg);
+			break;
+		case 'i':
+			period = strtoull(optarg, NULL, 10);
+			break;
+		case 'I':
+			intervalFile = optarg;
+			break;
+		case 'M':
+			if(strcmp(optarg, "bus") == 0){
+				directory = 0;
+			} else if(strcmp(optarg, "dir") == 0){
+				directory = 1;
+			} else {
+				printf("unknown coherence model: %s\n", optarg);
+				exit(1);
+			}
+			break;
 		case 's':
 			s = atoi(optarg); //convert to int
 			break;
@@ -290,6 +1943,77 @@ int main(int argc, char** argv){
 			break;
 		case 't':
 			traceFile = optarg;
+			traceFiles = (char**) realloc(traceFiles, sizeof(char*) * (traceCount + 1));
+			traceFiles[traceCount++] = optarg;
+			break;
+		case 'g':
+			parseGeometries(optarg, &geometries, &geometryCount);
+			break;
+		case 'j':
+			workers = atoi(optarg);
+			if(workers < 1){
+				workers = 1;
+			}
+			break;
+		case 'A':
+			maxE = atoi(optarg);
+			break;
+		case 'm':
+			budget = atoi(optarg);
+			if(budget < 2){
+				printf("the sample budget must be at least 2 lines\n");
+				exit(1);
+			}
+			break;
+		case 'L':
+			levels = (geometry*) realloc(levels, sizeof(geometry) * (levelCount + 1));
+			if(sscanf(optarg, "%d/%d/%d", &levels[levelCount].s, 
+						&levels[levelCount].E, &levels[levelCount].b) != 3){
+				printf("levels look like s/E/b, e.g. 6/8/6: %s\n", optarg);
+				exit(1);
+			}
+			levelCount++;
+			break;
+		case 'H':
+			if(strcmp(optarg, "inclusive") == 0){
+				inclusion = INCLUSIVE;
+			} else if(strcmp(optarg, "exclusive") == 0){
+				inclusion = EXCLUSIVE;
+			} else if(strcmp(optarg, "nine") == 0){
+				inclusion = NINE;
+			} else {
+				printf("unknown inclusion policy: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'p':
+			policy = findPolicy(optarg);
+			if(policy == NULL){
+				printf("unknown replacement policy: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'r':
+			regionBits = atoi(optarg);
+			if(regionBits < 0 || regionBits > 63){
+				printf("region bits must be between 0 and 63\n");
+				exit(1);
+			}
+			break;
+		case 'o':
+			outputFile = optarg;
+			break;
+		case 'w':
+			if(strcmp(optarg, "wb") == 0){
+				write = WRITE_BACK;
+			} else if(strcmp(optarg, "wt") == 0){
+				write = WRITE_THROUGH;
+			} else if(strcmp(optarg, "wtb") == 0){
+				write = WRITE_BUFFERED;
+			} else {
+				printf("unknown write policy: %s\n", optarg);
+				exit(1);
+			}
 			break;
 		default:
 		//If we get an unexpected flag, print error message and exit. 
@@ -298,33 +2022,239 @@ int main(int argc, char** argv){
 		}	
 	}
 	
-	/* Helper documentation if helper flag triggered */ 
-	if(h == 1){
-		printf("This function is a cache simulator. \n\
-	It takes the following flagged command line arguments:\n\
-		-s: # of index bits \n\
- 		-E: # of lines per set\n\
- 		-b: # of offset bits\n\
- 		-t: tracefile\n\
- 		-h: optional flag which prints help information\n\
- 		-v: optional flag for more verbose output\n\
-	Example usage includes: cachesim -s 1 -E 4 -b 10 -t t1.trace");
+	/* Every mode reads a trace, or a list of them */
+	if(traceFile == NULL && batchFile == NULL){
+		printf("Usage: %s -s <s> -E <E> -b <b> -t <tracefile>, or -h for help\n", argv[0]);
+		exit(1);
+	}
+
+	/* Benchmark mode only measures parsing, it does not simulate */
+	if(B == 1){
+		benchmarkTrace(traceFile);
+		return 0;
+	}
+
+	/* Only a single cache follows every access, so the options that 
+	 * need that cannot be combined with the other modes, and neither 
+	 * can the modes with each other */
+	char* perAccess = v ? "-v" : write != WRITE_NONE ? "-w" : l ? "-l" 
+					: prefetchKind != NULL ? "-f" : tlb != NULL ? "-T" 
+					: classify ? "-c" : regionBits >= 0 ? "-r" : period > 0 ? "-i" 
+					: O ? "-O" : P ? "-P" : NULL;
+	char* modes[6];
+	int modeCount = 0;
+	if(batchFile != NULL){
+		modes[modeCount++] = "--batch";
+	}
+	if(traceCount > 1){
+		modes[modeCount++] = "several -t";
+	}
+	if(levelCount > 0){
+		modes[modeCount++] = "-L";
+	}
+	if(maxE > 0){
+		modes[modeCount++] = "-A";
+	}
+	if(budget > 0){
+		modes[modeCount++] = "-m";
+	}
+	if(geometryCount > 0 && batchFile == NULL){
+		modes[modeCount++] = "-g";
+	}
+	if(modeCount > 1){
+		printf("%s cannot be combined with %s\n", modes[0], modes[1]);
+		exit(1);
+	}
+	if(modeCount == 1 && perAccess != NULL){
+		printf("%s cannot be combined with %s\n", perAccess, modes[0]);
+		exit(1);
+	}
+	if((maxE > 0 || budget > 0) && policy != NULL && strcmp(policy->name, "lru") != 0){
+		printf("%s models LRU replacement only\n", maxE > 0 ? "-A" : "-m");
+		exit(1);
+	}
+
+	/* Batches write a CSV row per trace and geometry */
+	if(batchFile != NULL){
+		if(geometryCount == 0){
+			geometries = (geometry*) malloc(sizeof(geometry));
+			geometries[0] = (geometry) { s, E, b };
+			geometryCount = 1;
+		}
+		int status = runBatch(batchFile, geometries, geometryCount, workers, 
+								policy, outputFile);
+		free(geometries);
+		free(traceFiles);
+		return status;
+	}
+
+	/* Several traces are several cores, which print a line each */
+	if(traceCount > 1){
+		runCoherence(traceFiles, traceCount, s, E, b, policy, order, directory);
+		free(traceFiles);
+		return 0;
+	}
+	free(traceFiles);
+
+	/* Hierarchies print a line per level before their summary */
+	if(levelCount > 0){
+		runHierarchy(traceFile, levels, levelCount, inclusion, policy);
+		free(levels);
+		return 0;
+	}
+
+	/* So does the stack distance analysis */
+	if(maxE > 0){
+		runStackDistance(traceFile, s, b, maxE);
+		return 0;
+	}
+
+	/* And the sampled miss ratio curve */
+	if(budget > 0){
+		runShards(traceFile, b, budget);
+		return 0;
+	}
+
+	/* Sweeps print a line per geometry instead of a single summary */
+	if(geometryCount > 0){
+		runSweep(traceFile, geometries, geometryCount, workers, policy);
+		free(geometries);
+		return 0;
+	}
+
+	// the optimal policy needs to read the trace twice, and replays it
+	// with neither write policy, line splitting nor prefetching
+	if(O == 1 && !isRegularFile(traceFile)){
+		printf("-O needs a regular trace file, not stdin or a pipe\n");
+		exit(1);
+	}
+	if(O == 1 && (write != WRITE_NONE || l || prefetchKind != NULL)){
+		printf("%s cannot be combined with -O\n", 
+			   write != WRITE_NONE ? "-w" : l ? "-l" : "-f");
+		exit(1);
 	}
 
 	// make the cache 
-	cacheLine*** cache = makeCache(s,E,b);
+	cache* cache = makeCacheOrExit(s,E,b,policy);
+	cache->write = write;
+	cache->splitLines = l;
+	cache->tlb = tlb;
+	if(period > 0){
+		cache->intervals = makeIntervalLog(intervalFile, period);
+	}
+	if(classify == 1){
+		cache->classify = makeClassifier(s, E);
+	}
+	if(prefetchKind != NULL){
+		cache->prefetch = makePrefetcher(prefetchKind, b);
+		if(cache->prefetch == NULL){
+			printf("unknown prefetcher: %s\n", prefetchKind);
+			exit(1);
+		}
+	}
 	
 	// create counters for hits, misses, evicts
-	int evicts = 0;
-	int hits = 0;
-	int misses = 0;
-	// run cache simulator
-	runCache(s, E, b, traceFile, cache, &evicts, &hits, &misses, v);
+	unsigned long long evicts = 0;
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	// attribute events to regions and sets if asked to
+	regionStats* regions = NULL;
+	if(regionBits >= 0){
+		regions = makeRegionStats(regionBits, s);
+	}
+
+	// run cache simulator, split by sets unless we follow every access
+	double start = now();
+	if(workers > 1 && v == 0 && regions == NULL && write == WRITE_NONE 
+	   && l == 0 && cache->prefetch == NULL && tlb == NULL && period == 0
+	   && classify == 0){
+		runCacheSharded(traceFile, cache, &evicts, &hits, &misses, workers);
+	} else {
+		runCache(traceFile, cache, &evicts, &hits, &misses, v, regions);
+	}
+	double elapsed = now() - start;
 	
+	// count what is still dirty before the cache goes away
+	unsigned long long dirty = dirtyLines(cache);
+	unsigned long long writebacks = cache->writebacks;
+	unsigned long long bytesRead = cache->bytesRead;
+	unsigned long long bytesWritten = cache->bytesWritten;
+	unsigned long long splitAccesses = cache->splitAccesses;
+	unsigned long long extraLines = cache->extraLines;
+	unsigned long long prefetches = cache->prefetches;
+	unsigned long long useful = cache->prefetchUseful;
+	unsigned long long useless = cache->prefetchUseless + unusedPrefetches(cache);
+	unsigned long long pollution = cache->pollution;
+	unsigned long long prefetchEvictions = cache->prefetchEvictions;
+	classifier* classified = cache->classify;
+	unsigned long long touched = touchedSets(cache);
+
 	// free up allocated space for cache
-	freeCache(cache, s, E);
+	if(cache->prefetch != NULL){
+		freePrefetcher(cache->prefetch);
+	}
+	freeCache(cache);
 		
 	// pass data to print summary
 	printSummary(hits, misses, evicts);
+
+	// and report the memory traffic if we followed a write policy
+	if(write != WRITE_NONE){
+		printf("writebacks:%llu dirty:%llu bytes_read:%llu bytes_written:%llu\n",
+			   writebacks, dirty, bytesRead, bytesWritten);
+	}
+
+	// and how many accesses spanned several lines if we split them
+	if(l == 1){
+		printf("split_accesses:%llu extra_lines:%llu\n", splitAccesses, extraLines);
+	}
+
+	// and how well the prefetcher did, counting prefetched blocks that 
+	// were never used by the end as useless
+	if(prefetchKind != NULL){
+		printf("prefetches:%llu useful:%llu useless:%llu accuracy:%.2f%% "
+			   "coverage:%.2f%% pollution:%llu prefetch_evictions:%llu\n",
+			   prefetches, useful, useless,
+			   prefetches ? 100.0 * useful / prefetches : 0.0,
+			   (useful + misses) ? 100.0 * useful / (useful + misses) : 0.0,
+			   pollution, prefetchEvictions);
+	}
+
+	// and the TLBs' hits, misses and page walks
+	if(tlb != NULL){
+		reportTLB(tlb);
+	}
+
+	// and what kind of misses they were
+	if(classified != NULL){
+		classifyWrite(classified, stdout);
+		freeClassifier(classified);
+	}
+
+	if(regions != NULL){
+		writeRegions(regions, outputFile);
+		freeRegionStats(regions);
+	}
+
+	// and how far the policy is from optimal on the same geometry
+	if(O == 1){
+		unsigned long long optEvicts = 0, optHits = 0, optMisses = 0;
+		runOptimal(traceFile, s, E, b, &optEvicts, &optHits, &optMisses);
+		printf("opt hits:%llu misses:%llu evictions:%llu avoidable_misses:%.2f%%\n",
+			   optHits, optMisses, optEvicts, 
+			   misses ? 100.0 * ((double) misses - optMisses) / misses : 0.0);
+	}
+
+	// and finally how fast that all was, counting every hit and miss as 
+	// an access, the most memory it took, and how many sets it needed
+	if(P == 1){
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		unsigned long long accesses = hits + misses;
+		printf("accesses:%llu seconds:%.3f accesses_per_sec:%.0f peak_rss_kb:%ld "
+			   "touched_sets:%llu/%llu\n",
+			   accesses, elapsed, elapsed > 0 ? accesses / elapsed : 0.0, 
+			   usage.ru_maxrss, touched, 1ULL << s);
+	}
 	return 0;	
 }
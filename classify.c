@@ -0,0 +1,248 @@
+/*
+ * classify.c - Compulsory, capacity and conflict miss classification
+ *
+ * Every line ever accessed gets an entry in one array, found through an
+ * open addressing hash table of entry numbers. The entries of the lines
+ * a fully associative LRU cache would hold form a doubly linked list in
+ * recency order, so a shadow access costs one hash lookup and a few
+ * link updates whatever the size of the cache. Lines that drop off the
+ * end of the list keep their entry, which is how a later miss on them
+ * is known not to be compulsory. Looking that up in the same table
+ * makes a separate first touch set unnecessary.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "classify.h"
+
+/* Entry number that links to nothing */
+#define NO_ENTRY 0xffffffffU
+
+/* Kinds of miss, in the order they are reported */
+enum { COMPULSORY, CAPACITY, CONFLICT, MISS_KINDS };
+
+/*
+ * A line's entry. prev and next link it into the shadow cache's list,
+ * most recently used first, while resident is 1.
+ */
+typedef struct lineNode{
+	unsigned long long line;
+	unsigned int prev;
+	unsigned int next;
+	int resident;
+} lineNode;
+
+/*
+ * Classifier state.
+ *  nodes, used, allocated - every line's entry
+ *  table - open addressing hash table of entry numbers plus one, so
+ *  		that 0 marks an empty slot
+ *  head, tail - the shadow cache's most and least recently used lines
+ *  capacity, resident - # of lines the shadow cache holds and has
+ *  misses - # of misses of each kind
+ *  setMisses - # of misses of each kind in each set
+ */
+struct classifier{
+	int s;
+	lineNode* nodes;
+	unsigned int used;
+	unsigned int allocated;
+	unsigned int* table;
+	unsigned long long tableSize;
+	unsigned int head;
+	unsigned int tail;
+	unsigned long long capacity;
+	unsigned long long resident;
+	unsigned long long misses[MISS_KINDS];
+	unsigned long long (*setMisses)[MISS_KINDS];
+};
+
+/* Hashes a line address into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashNode(unsigned long long line,
+										  unsigned long long mask){
+	return ((line * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table slot of line, or the empty slot it would take */
+static inline unsigned long long nodeSlot(classifier* cl, unsigned long long line){
+	unsigned long long mask = cl->tableSize - 1;
+	unsigned long long i = hashNode(line, mask);
+	while(cl->table[i] != 0 && cl->nodes[cl->table[i] - 1].line != line){
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/* Doubles the size of the hash table */
+static void growNodes(classifier* cl){
+	free(cl->table);
+	cl->tableSize *= 2;
+	cl->table = (unsigned int*) calloc(cl->tableSize, sizeof(unsigned int));
+	if(cl->table == NULL){
+		printf("Classifier allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	for(unsigned int n = 0; n < cl->used; n++){
+		cl->table[nodeSlot(cl, cl->nodes[n].line)] = n + 1;
+	}
+}
+
+/* Removes node n from the shadow cache's list */
+static inline void unlinkNode(classifier* cl, unsigned int n){
+	lineNode* node = &cl->nodes[n];
+	if(node->prev != NO_ENTRY){
+		cl->nodes[node->prev].next = node->next;
+	} else {
+		cl->head = node->next;
+	}
+	if(node->next != NO_ENTRY){
+		cl->nodes[node->next].prev = node->prev;
+	} else {
+		cl->tail = node->prev;
+	}
+}
+
+/* Puts node n at the front of the shadow cache's list */
+static inline void pushNode(classifier* cl, unsigned int n){
+	lineNode* node = &cl->nodes[n];
+	node->prev = NO_ENTRY;
+	node->next = cl->head;
+	if(cl->head != NO_ENTRY){
+		cl->nodes[cl->head].prev = n;
+	} else {
+		cl->tail = n;
+	}
+	cl->head = n;
+}
+
+classifier* makeClassifier(int s, int E){
+	classifier* cl = (classifier*) calloc(1, sizeof(classifier));
+	if(cl == NULL){
+		printf("Classifier allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	cl->s = s;
+	cl->capacity = (unsigned long long) E << s;
+	cl->head = NO_ENTRY;
+	cl->tail = NO_ENTRY;
+	cl->allocated = 1024;
+	cl->nodes = (lineNode*) malloc(sizeof(lineNode) * cl->allocated);
+	cl->tableSize = 2048;
+	cl->table = (unsigned int*) calloc(cl->tableSize, sizeof(unsigned int));
+	cl->setMisses = calloc(1ULL << s, sizeof(*cl->setMisses));
+	if(cl->nodes == NULL || cl->table == NULL || cl->setMisses == NULL){
+		printf("Classifier allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	return cl;
+}
+
+void classifyAccess(classifier* cl, unsigned long long line,
+					unsigned long long index, int miss, int allocate){
+	unsigned long long slot = nodeSlot(cl, line);
+	unsigned int n;
+	int kind;
+	if(cl->table[slot] == 0 && !allocate){
+		/* A line only counts as accessed once it was placed, so a store
+		 * that does not allocate it leaves it untracked and its next
+		 * miss compulsory */
+		kind = COMPULSORY;
+	} else {
+		if(cl->table[slot] == 0){
+			/* First touch: a new entry, which is not resident yet */
+			if(cl->used == cl->allocated){
+				cl->allocated *= 2;
+				cl->nodes = (lineNode*) realloc(cl->nodes, sizeof(lineNode) * cl->allocated);
+				if(cl->nodes == NULL){
+					printf("Classifier allocation failed");
+					exit(EXIT_FAILURE);
+				}
+			}
+			n = cl->used++;
+			cl->nodes[n].line = line;
+			cl->nodes[n].resident = 0;
+			cl->table[slot] = n + 1;
+			/* Keep the table at most half full so probes stay short */
+			if(2ULL * cl->used > cl->tableSize){
+				growNodes(cl);
+			}
+			kind = COMPULSORY;
+		} else {
+			n = cl->table[slot] - 1;
+			kind = cl->nodes[n].resident ? CONFLICT : CAPACITY;
+		}
+
+		/* Access the shadow cache: move the line to the front, evicting
+		 * the least recently used line if it did not fit. Like the real
+		 * cache, a store that does not allocate only refreshes a resident
+		 * line. */
+		if(cl->nodes[n].resident){
+			unlinkNode(cl, n);
+			pushNode(cl, n);
+		} else if(allocate){
+			cl->nodes[n].resident = 1;
+			cl->resident++;
+			if(cl->resident > cl->capacity){
+				unsigned int last = cl->tail;
+				unlinkNode(cl, last);
+				cl->nodes[last].resident = 0;
+				cl->resident--;
+			}
+			pushNode(cl, n);
+		}
+	}
+
+	if(miss){
+		cl->misses[kind]++;
+		cl->setMisses[index][kind]++;
+	}
+}
+
+/* Orders set numbers by their conflict misses, most first */
+static unsigned long long (*sortMisses)[MISS_KINDS];
+static int byConflicts(const void* a, const void* b){
+	unsigned long long x = *(const unsigned long long*) a;
+	unsigned long long y = *(const unsigned long long*) b;
+	if(sortMisses[x][CONFLICT] != sortMisses[y][CONFLICT]){
+		return sortMisses[x][CONFLICT] < sortMisses[y][CONFLICT] ? 1 : -1;
+	}
+	return x < y ? -1 : x > y;
+}
+
+void classifyWrite(classifier* cl, FILE* out){
+	unsigned long long total = cl->misses[COMPULSORY] + cl->misses[CAPACITY] 
+								+ cl->misses[CONFLICT];
+	fprintf(out, "compulsory:%llu capacity:%llu conflict:%llu", 
+			cl->misses[COMPULSORY], cl->misses[CAPACITY], cl->misses[CONFLICT]);
+	if(total > 0){
+		fprintf(out, " (%.1f%% %.1f%% %.1f%%)", 
+				100.0 * cl->misses[COMPULSORY] / total,
+				100.0 * cl->misses[CAPACITY] / total,
+				100.0 * cl->misses[CONFLICT] / total);
+	}
+	fprintf(out, "\n");
+
+	unsigned long long sets = 1ULL << cl->s;
+	unsigned long long* order = (unsigned long long*) malloc(sizeof(unsigned long long) * sets);
+	for(unsigned long long i = 0; i < sets; i++){
+		order[i] = i;
+	}
+	sortMisses = cl->setMisses;
+	qsort(order, sets, sizeof(unsigned long long), byConflicts);
+	for(unsigned long long i = 0; i < sets && i < CLASSIFY_TOP; i++){
+		unsigned long long* m = cl->setMisses[order[i]];
+		if(m[COMPULSORY] + m[CAPACITY] + m[CONFLICT] == 0){
+			break;
+		}
+		fprintf(out, "set %llu compulsory:%llu capacity:%llu conflict:%llu\n",
+				order[i], m[COMPULSORY], m[CAPACITY], m[CONFLICT]);
+	}
+	free(order);
+}
+
+void freeClassifier(classifier* cl){
+	free(cl->nodes);
+	free(cl->table);
+	free(cl->setMisses);
+	free(cl);
+}
@@ -0,0 +1,48 @@
+/*
+ * classify.h - Prototypes for sorting misses into compulsory, capacity
+ * and conflict misses
+ *
+ * A miss is compulsory if its line was never accessed before. Any
+ * other miss is a capacity miss if a fully associative LRU cache with
+ * the same number of lines would also have missed, since no placement
+ * could have kept the line, and a conflict miss if it would have hit.
+ */
+
+#ifndef CLASSIFY_TOOLS_H
+#define CLASSIFY_TOOLS_H
+
+#include <stdio.h>
+
+/* Number of sets listed by classifyWrite */
+#define CLASSIFY_TOP 16
+
+typedef struct classifier classifier;
+
+/*
+ * makeClassifier - Creates a classifier for a cache with 2^s sets of E
+ * lines each.
+ */
+classifier* makeClassifier(int s, int E);
+
+/*
+ * classifyAccess - Records an access to the line with line address
+ * line (the address without its offset bits) in set index, and
+ * classifies it if miss is 1. allocate is 0 for stores that do not
+ * allocate in the real cache, which leave the shadow cache alone too.
+ */
+void classifyAccess(classifier* cl, unsigned long long line,
+					unsigned long long index, int miss, int allocate);
+
+/*
+ * classifyWrite - Writes the run's compulsory, capacity and conflict
+ * misses to out, followed by those of the CLASSIFY_TOP sets with the
+ * most conflict misses.
+ */
+void classifyWrite(classifier* cl, FILE* out);
+
+/*
+ * freeClassifier - Frees everything makeClassifier allocated.
+ */
+void freeClassifier(classifier* cl);
+
+#endif /* CLASSIFY_TOOLS_H */
@@ -0,0 +1,145 @@
+/*
+ * intervals.c - Windowed cache statistics
+ *
+ * Windows can be short, so lines are formatted by hand into a large
+ * buffer that goes out with one write call whenever it fills up,
+ * rather than through printf and stdio. Lines that go to stdout, or
+ * to the file stdout already writes to, are handed to stdio one at a
+ * time instead, so that they stay in order with the -v lines and the
+ * summary printed around them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "intervals.h"
+
+/* Size of the output buffer, and the most one line can take */
+#define INTERVAL_BUFFER (1 << 16)
+#define INTERVAL_LINE 160
+
+/* Writes out everything in the buffer */
+static void flushIntervals(intervalLog* log){
+	if(log->shared){
+		if(fwrite(log->buffer, 1, log->used, stdout) != log->used){
+			printf("Interval write failed\n");
+			exit(EXIT_FAILURE);
+		}
+		log->used = 0;
+		return;
+	}
+	size_t done = 0;
+	while(done < log->used){
+		ssize_t n = write(log->fd, log->buffer + done, log->used - done);
+		if(n <= 0){
+			printf("Interval write failed\n");
+			exit(EXIT_FAILURE);
+		}
+		done += n;
+	}
+	log->used = 0;
+}
+
+/* Appends value in decimal followed by c to the buffer */
+static inline void appendNumber(intervalLog* log, unsigned long long value, char c){
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while(value != 0);
+	char* out = log->buffer + log->used;
+	while(n > 0){
+		*out++ = digits[--n];
+	}
+	*out++ = c;
+	log->used = out - log->buffer;
+}
+
+intervalLog* makeIntervalLog(const char* path, unsigned long long period){
+	intervalLog* log = (intervalLog*) calloc(1, sizeof(intervalLog));
+	if(log == NULL || (log->buffer = (char*) malloc(INTERVAL_BUFFER)) == NULL){
+		printf("Interval log allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	log->fd = (path == NULL) ? STDOUT_FILENO 
+							 : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(log->fd < 0){
+		printf("Could not write %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	struct stat file, out;
+	if(log->fd != STDOUT_FILENO && fstat(log->fd, &file) == 0 && 
+	   fstat(STDOUT_FILENO, &out) == 0 &&
+	   file.st_dev == out.st_dev && file.st_ino == out.st_ino){
+		close(log->fd);
+		log->fd = STDOUT_FILENO;
+	}
+	log->shared = log->fd == STDOUT_FILENO;
+	log->period = period;
+	log->left = period;
+
+	const char* header = "window,start,accesses,hits,misses,evictions,miss_rate\n";
+	memcpy(log->buffer, header, strlen(header));
+	log->used = strlen(header);
+	if(log->shared){
+		flushIntervals(log);
+	}
+	return log;
+}
+
+void intervalWrite(intervalLog* log, unsigned long long hits,
+				   unsigned long long misses, unsigned long long evictions){
+	if(log->used + INTERVAL_LINE > INTERVAL_BUFFER){
+		flushIntervals(log);
+	}
+	unsigned long long accesses = log->period - log->left;
+	if(log->left == 0){
+		accesses = log->period;
+	}
+	unsigned long long windowHits = hits - log->hits;
+	unsigned long long windowMisses = misses - log->misses;
+	appendNumber(log, log->window, ',');
+	appendNumber(log, log->window * log->period, ',');
+	appendNumber(log, accesses, ',');
+	appendNumber(log, windowHits, ',');
+	appendNumber(log, windowMisses, ',');
+	appendNumber(log, evictions - log->evictions, ',');
+
+	/* The miss rate of the window's hits and misses to six places, which
+	 * a multiply and a divide give without going through floating point */
+	unsigned long long lookups = windowHits + windowMisses;
+	unsigned long long rate = lookups ? (windowMisses * 1000000 + lookups / 2) / lookups : 0;
+	appendNumber(log, rate / 1000000, '.');
+	char* out = log->buffer + log->used;
+	for(int i = 5; i >= 0; i--){
+		out[i] = '0' + rate % 10;
+		rate /= 10;
+	}
+	out[6] = '\n';
+	log->used += 7;
+
+	log->window++;
+	log->left = log->period;
+	log->hits = hits;
+	log->misses = misses;
+	log->evictions = evictions;
+	if(log->shared){
+		flushIntervals(log);
+	}
+}
+
+void closeIntervalLog(intervalLog* log, unsigned long long hits,
+					  unsigned long long misses, unsigned long long evictions){
+	if(log->left != log->period){
+		intervalWrite(log, hits, misses, evictions);
+	}
+	flushIntervals(log);
+	if(log->fd != STDOUT_FILENO){
+		close(log->fd);
+	}
+	free(log->buffer);
+	free(log);
+}
@@ -0,0 +1,70 @@
+/*
+ * intervals.h - Prototypes for windowed cache statistics
+ *
+ * An interval log splits a run into windows of a fixed number of
+ * accesses and writes one CSV line per window with the hits, misses
+ * and evictions that happened inside it.
+ */
+
+#ifndef INTERVALS_TOOLS_H
+#define INTERVALS_TOOLS_H
+
+#include <stddef.h>
+
+/*
+ * Log state. It is public so that intervalAccess can be inlined.
+ *  period - # of accesses per window
+ *  left - # of accesses still missing from the current window
+ *  window - # of the current window, counting from 0
+ *  hits, misses, evictions - the run's totals when the window began
+ *  fd, buffer, used - where lines go, and the lines not written yet
+ *  shared - 1 if fd is stdout's file, so lines go through stdio
+ */
+typedef struct intervalLog {
+	unsigned long long period;
+	unsigned long long left;
+	unsigned long long window;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	int fd;
+	char* buffer;
+	size_t used;
+	int shared;
+} intervalLog;
+
+/*
+ * makeIntervalLog - Creates a log of windows of period accesses that
+ * writes to path, or to stdout if path is NULL, and writes the CSV
+ * header.
+ */
+intervalLog* makeIntervalLog(const char* path, unsigned long long period);
+
+/*
+ * intervalWrite - Ends the current window given the running totals of
+ * the run so far. Called by intervalAccess.
+ */
+void intervalWrite(intervalLog* log, unsigned long long hits,
+				   unsigned long long misses, unsigned long long evictions);
+
+/*
+ * intervalAccess - Counts one access, given the running totals after
+ * it, and ends the window if it is full. Most calls are one decrement
+ * and one compare.
+ */
+static inline void intervalAccess(intervalLog* log, unsigned long long hits,
+								  unsigned long long misses,
+								  unsigned long long evictions){
+	if(--log->left == 0){
+		intervalWrite(log, hits, misses, evictions);
+	}
+}
+
+/*
+ * closeIntervalLog - Writes the last, partial window if it holds any
+ * accesses, flushes the log and frees it.
+ */
+void closeIntervalLog(intervalLog* log, unsigned long long hits,
+					  unsigned long long misses, unsigned long long evictions);
+
+#endif /* INTERVALS_TOOLS_H */
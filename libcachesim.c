@@ -0,0 +1,107 @@
+/*
+ * libcachesim.c - The embeddable cache simulator API
+ *
+ * A thin layer over the cache model in cachecore.c. Outcomes are
+ * tallied in a small array indexed by accessOutcome, so the batch loop
+ * neither branches on them nor touches any strings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libcachesim.h"
+#include "cachecore.h"
+
+/*
+ * Simulator state.
+ *  outcomes - # of accesses with each accessOutcome
+ *  modifyHits - # of modify writes counted as hits without a store,
+ *  		which is how stores are handled without a write policy
+ */
+struct cachesim {
+	cache* cache;
+	uint64_t accesses;
+	uint64_t outcomes[3];
+	uint64_t modifyHits;
+};
+
+cachesim* cachesim_create(int s, int E, int b, const char* policy,
+						  const char* write){
+	if(s < 0 || b < 0 || s + b > 64 || s > 40 || E < 1){
+		return NULL;
+	}
+	const replacementPolicy* replacement = NULL;
+	if(policy != NULL && (replacement = findPolicy(policy)) == NULL){
+		return NULL;
+	}
+	writePolicy writes = WRITE_NONE;
+	if(write != NULL){
+		if(strcmp(write, "wb") == 0){
+			writes = WRITE_BACK;
+		} else if(strcmp(write, "wt") == 0){
+			writes = WRITE_THROUGH;
+		} else if(strcmp(write, "wtb") == 0){
+			writes = WRITE_BUFFERED;
+		} else {
+			return NULL;
+		}
+	}
+
+	cachesim* sim = (cachesim*) calloc(1, sizeof(cachesim));
+	if(sim == NULL){
+		return NULL;
+	}
+	sim->cache = makeCache(s, E, b, replacement);
+	if(sim->cache == NULL){
+		free(sim);
+		return NULL;
+	}
+	sim->cache->write = writes;
+	return sim;
+}
+
+void cachesim_access_batch(cachesim* sim, const uint64_t* addrs,
+						   const char* ops, size_t n){
+	cache* cache = sim->cache;
+	uint64_t* outcomes = sim->outcomes;
+	accessOutcome outcome;
+
+	if(ops == NULL){
+		for(size_t i = 0; i < n; i++){
+			cacheAccessBlock(cache, addrs[i], &outcome);
+			outcomes[outcome]++;
+		}
+		sim->accesses += n;
+		return;
+	}
+
+	for(size_t i = 0; i < n; i++){
+		char op = ops[i];
+		if(op == 'M' || op == 'L' || cache->write == WRITE_NONE){
+			cacheAccessBlock(cache, addrs[i], &outcome);
+			outcomes[outcome]++;
+		}
+		if(op == 'M' && cache->write == WRITE_NONE){
+			sim->modifyHits++;
+		} else if(op != 'L' && cache->write != WRITE_NONE){
+			cacheStoreBlock(cache, addrs[i], CACHESIM_STORE_BYTES, &outcome);
+			outcomes[outcome]++;
+		}
+	}
+	sim->accesses += n;
+}
+
+void cachesim_stats(cachesim* sim, cachesim_counts* counts){
+	flushWrites(sim->cache);
+	counts->accesses = sim->accesses;
+	counts->hits = sim->outcomes[ACCESS_HIT] + sim->modifyHits;
+	counts->misses = sim->outcomes[ACCESS_MISS] + sim->outcomes[ACCESS_EVICT];
+	counts->evictions = sim->outcomes[ACCESS_EVICT];
+	counts->writebacks = sim->cache->writebacks;
+	counts->bytes_read = sim->cache->bytesRead;
+	counts->bytes_written = sim->cache->bytesWritten;
+}
+
+void cachesim_destroy(cachesim* sim){
+	freeCache(sim->cache);
+	free(sim);
+}
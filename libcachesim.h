@@ -0,0 +1,83 @@
+/*
+ * libcachesim.h - An embeddable cache simulator
+ *
+ * Tools that capture their own traces can simulate a cache in-process
+ * instead of writing a trace file for cachesim:
+ *
+ * 	cachesim* sim = cachesim_create(6, 8, 6, "lru", NULL);
+ * 	cachesim_access_batch(sim, addrs, ops, n);
+ * 	cachesim_counts counts;
+ * 	cachesim_stats(sim, &counts);
+ * 	cachesim_destroy(sim);
+ *
+ * Accesses are simulated exactly as cachesim simulates a trace with
+ * the same records, without any of its per-access reporting.
+ */
+
+#ifndef LIBCACHESIM_H
+#define LIBCACHESIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Only the cachesim_ functions are exported from the shared library */
+#if defined(__GNUC__)
+#define CACHESIM_EXPORT __attribute__((visibility("default")))
+#else
+#define CACHESIM_EXPORT
+#endif
+
+typedef struct cachesim cachesim;
+
+/*
+ * Totals of a simulation so far.
+ *  accesses - # of accesses given to cachesim_access_batch
+ *  hits, misses, evictions - as cachesim counts them, so a modify is a
+ *  		load followed by a store that hits
+ *  writebacks - # of dirty blocks written back (write-back only)
+ *  bytes_read, bytes_written - memory traffic below the cache
+ */
+typedef struct cachesim_counts {
+	uint64_t accesses;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+} cachesim_counts;
+
+/* Bytes a store writes through to memory, since batches carry no sizes */
+#define CACHESIM_STORE_BYTES 8
+
+/*
+ * cachesim_create - Creates an empty cache of 2^s sets of E lines of
+ * 2^b bytes. policy names the replacement policy (lru, fifo, random,
+ * plru, srrip, brrip or lfu) and write the write policy (wb, wt or
+ * wtb); NULL picks lru and cachesim's default of treating stores like
+ * loads. Returns NULL if an argument is out of range or unknown, or if
+ * the cache cannot be allocated.
+ */
+CACHESIM_EXPORT cachesim* cachesim_create(int s, int E, int b, const char* policy,
+						  const char* write);
+
+/*
+ * cachesim_access_batch - Simulates n accesses to addrs[0..n). ops[i]
+ * is 'L', 'S' or 'M' for a load, store or modify, and ops may be NULL
+ * if every access is a load.
+ */
+CACHESIM_EXPORT void cachesim_access_batch(cachesim* sim, const uint64_t* addrs,
+										   const char* ops, size_t n);
+
+/*
+ * cachesim_stats - Fills counts with the totals so far. Stores still
+ * waiting in the write buffer are written out first.
+ */
+CACHESIM_EXPORT void cachesim_stats(cachesim* sim, cachesim_counts* counts);
+
+/*
+ * cachesim_destroy - Frees the simulator.
+ */
+CACHESIM_EXPORT void cachesim_destroy(cachesim* sim);
+
+#endif /* LIBCACHESIM_H */
@@ -0,0 +1,210 @@
+/*
+ * nextuse.c - Building a trace's next-use index
+ *
+ * One pass over the trace remembers the position of the latest access
+ * to every line in an open addressing hash table. When the line comes
+ * up again, the distance from there is written back into that earlier
+ * record's slot, so every distance is known by the end of the pass.
+ *
+ * The index is 4 bytes per record, which is still gigabytes for the
+ * longest traces. Small indexes live in anonymous memory, and once one
+ * outgrows NEXT_USE_MEMORY_MAX it moves to an unlinked temporary file
+ * mapped in its place, which the kernel can write back and drop under
+ * memory pressure instead of swapping it out.
+ */
+#define _GNU_SOURCE /* for mremap */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "nextuse.h"
+#include "trace.h"
+
+/* Largest index kept in anonymous memory, in bytes */
+#define NEXT_USE_MEMORY_MAX (256ULL << 20)
+
+/* Records the index has room for at first */
+#define NEXT_USE_MIN (1ULL << 16)
+
+/*
+ * A line's latest access. key is the line address plus one, so that 0
+ * marks an empty table entry.
+ */
+typedef struct lastUse{
+	unsigned long long key;
+	unsigned long long position;
+} lastUse;
+
+/*
+ * The index.
+ *  distances, count, capacity - the distance of each record, mapped
+ *  		anonymously or from the temporary file fd if it is not -1
+ *  table - open addressing hash table of every line's latest access
+ */
+struct nextUse{
+	unsigned int* distances;
+	unsigned long long count;
+	unsigned long long capacity;
+	int fd;
+	lastUse* table;
+	unsigned long long tableSize;
+	unsigned long long tableUsed;
+};
+
+/* Hashes a line address into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashUse(unsigned long long line,
+										 unsigned long long mask){
+	return ((line * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table entry of line, claiming an empty one if needed */
+static lastUse* findUse(nextUse* nu, unsigned long long line){
+	unsigned long long mask = nu->tableSize - 1;
+	unsigned long long i = hashUse(line, mask);
+	while(nu->table[i].key != line + 1 && nu->table[i].key != 0){
+		i = (i + 1) & mask;
+	}
+	return &nu->table[i];
+}
+
+/* Doubles the size of the hash table */
+static void growUses(nextUse* nu){
+	lastUse* old = nu->table;
+	unsigned long long oldSize = nu->tableSize;
+	nu->tableSize *= 2;
+	nu->table = (lastUse*) calloc(nu->tableSize, sizeof(lastUse));
+	if(nu->table == NULL){
+		fprintf(stderr, "Next-use table allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for(unsigned long long i = 0; i < oldSize; i++){
+		if(old[i].key != 0){
+			*findUse(nu, old[i].key - 1) = old[i];
+		}
+	}
+	free(old);
+}
+
+/* Creates an unlinked temporary file of bytes bytes for the index */
+static int createIndexFile(unsigned long long bytes){
+	const char* dir = getenv("TMPDIR");
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/cachesim-nextuse-XXXXXX",
+			 dir != NULL ? dir : "/tmp");
+	int fd = mkstemp(path);
+	if(fd < 0){
+		fprintf(stderr, "Could not create a temporary file in %s\n", dir != NULL ? dir : "/tmp");
+		exit(EXIT_FAILURE);
+	}
+	unlink(path);
+	if(ftruncate(fd, bytes) != 0){
+		fprintf(stderr, "Could not grow the next-use index to %llu bytes\n", bytes);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/* Doubles the room in the index, moving it to a file if it got big */
+static void growIndex(nextUse* nu){
+	unsigned long long oldBytes = nu->capacity * sizeof(unsigned int);
+	unsigned long long bytes = 2 * oldBytes;
+	void* grown;
+	if(nu->fd < 0 && bytes > NEXT_USE_MEMORY_MAX){
+		nu->fd = createIndexFile(bytes);
+		grown = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, nu->fd, 0);
+		if(grown != MAP_FAILED){
+			memcpy(grown, nu->distances, oldBytes);
+			munmap(nu->distances, oldBytes);
+		}
+	} else {
+		if(nu->fd >= 0 && ftruncate(nu->fd, bytes) != 0){
+			fprintf(stderr, "Could not grow the next-use index to %llu bytes\n", bytes);
+			exit(EXIT_FAILURE);
+		}
+		grown = mremap(nu->distances, oldBytes, bytes, MREMAP_MAYMOVE);
+	}
+	if(grown == MAP_FAILED){
+		fprintf(stderr, "Could not map %llu bytes for the next-use index\n", bytes);
+		exit(EXIT_FAILURE);
+	}
+	nu->distances = (unsigned int*) grown;
+	nu->capacity *= 2;
+}
+
+nextUse* buildNextUse(const char* traceFile, int b){
+	traceReader* reader = traceOpen(traceFile);
+	if(reader == NULL){
+		return NULL;
+	}
+	nextUse* nu = (nextUse*) calloc(1, sizeof(nextUse));
+	if(nu == NULL){
+		fprintf(stderr, "Next-use index allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	nu->fd = -1;
+	nu->capacity = NEXT_USE_MIN;
+	nu->distances = (unsigned int*) mmap(NULL, nu->capacity * sizeof(unsigned int),
+										 PROT_READ | PROT_WRITE,
+										 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	nu->tableSize = 1024;
+	nu->table = (lastUse*) calloc(nu->tableSize, sizeof(lastUse));
+	if(nu->distances == MAP_FAILED || nu->table == NULL){
+		fprintf(stderr, "Next-use index allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	traceRecord batch[TRACE_BATCH];
+	size_t n;
+	while((n = traceRead(reader, batch, TRACE_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			if(nu->count == nu->capacity){
+				growIndex(nu);
+			}
+			unsigned long long line = (b >= 64) ? 0 : batch[i].address >> b;
+			lastUse* use = findUse(nu, line);
+			if(use->key != 0){
+				unsigned long long distance = nu->count - use->position;
+				nu->distances[use->position] = distance > 0xffffffffULL ?
+												0xffffffffU : (unsigned int) distance;
+			} else {
+				use->key = line + 1;
+				nu->tableUsed++;
+			}
+			use->position = nu->count;
+			/* Until the line comes up again this is its last access */
+			nu->distances[nu->count++] = NEXT_USE_NEVER;
+
+			/* Keep the table at most half full so probes stay short */
+			if(2 * nu->tableUsed > nu->tableSize){
+				growUses(nu);
+			}
+		}
+	}
+	int status = traceClose(reader);
+
+	/* Only the distances are needed from here on */
+	free(nu->table);
+	nu->table = NULL;
+	if(status != 0){
+		freeNextUse(nu);
+		return NULL;
+	}
+	return nu;
+}
+
+unsigned long long nextUseCount(nextUse* nu){
+	return nu->count;
+}
+
+const unsigned int* nextUseDistances(nextUse* nu){
+	return nu->distances;
+}
+
+void freeNextUse(nextUse* nu){
+	munmap(nu->distances, nu->capacity * sizeof(unsigned int));
+	if(nu->fd >= 0){
+		close(nu->fd);
+	}
+	free(nu);
+}
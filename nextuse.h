@@ -0,0 +1,42 @@
+/*
+ * nextuse.h - Prototypes for building a trace's next-use index
+ *
+ * Bélády's optimal replacement evicts the line whose next access lies
+ * farthest in the future, so it needs to know, for every access, when
+ * its line is accessed next. The index answers that for every record
+ * of a trace in one pass over it.
+ */
+
+#ifndef NEXTUSE_TOOLS_H
+#define NEXTUSE_TOOLS_H
+
+/* Distance stored for an access whose line is never accessed again */
+#define NEXT_USE_NEVER 0
+
+typedef struct nextUse nextUse;
+
+/*
+ * buildNextUse - Reads traceFile and records, for each of its records,
+ * how many records later the next access to the same line of 2^b bytes
+ * is. Distances that do not fit in 32 bits are stored as the largest
+ * one that does. Returns NULL if traceFile cannot be read.
+ */
+nextUse* buildNextUse(const char* traceFile, int b);
+
+/*
+ * nextUseCount - Returns the number of records in the index.
+ */
+unsigned long long nextUseCount(nextUse* nu);
+
+/*
+ * nextUseDistances - Returns the next-use distance of every record, in
+ * trace order, with NEXT_USE_NEVER for the last access to a line.
+ */
+const unsigned int* nextUseDistances(nextUse* nu);
+
+/*
+ * freeNextUse - Frees everything buildNextUse allocated.
+ */
+void freeNextUse(nextUse* nu);
+
+#endif /* NEXTUSE_TOOLS_H */
@@ -0,0 +1,253 @@
+/*
+ * prefetch.c - Hardware prefetcher models
+ *
+ * Three classic designs, all without the instruction pointer a real
+ * prefetcher could use, since traces do not record it:
+ *  next - tagged next-line prefetching. A miss, or the first hit to a
+ *  		prefetched line, fetches the following line.
+ *  stride - a table keyed by 4 KiB region remembers the last line and
+ *  		stride seen in the region, and fetches PREFETCH_DEGREE strides
+ *  		ahead once the same stride repeats.
+ *  stream - two misses to adjacent lines start a stream in their
+ *  		direction, which is then kept PREFETCH_DEPTH lines ahead of
+ *  		the accesses that follow it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prefetch.h"
+
+/* Entries in the stride table, and the region size it keys on */
+#define STRIDE_ENTRIES 256
+#define STRIDE_REGION_BITS 12
+
+/* Lines fetched ahead by the stride prefetcher once it is confident */
+#define PREFETCH_DEGREE 2
+
+/* Streams followed at once, how far ahead they run, and how many
+ * recent misses are kept to start new ones */
+#define STREAM_COUNT 8
+#define PREFETCH_DEPTH 4
+#define MISS_HISTORY 16
+
+/* Entries in the table of lines evicted by prefetches */
+#define POLLUTION_ENTRIES 4096
+
+typedef enum prefetchKind{
+	PREFETCH_NEXT,
+	PREFETCH_STRIDE,
+	PREFETCH_STREAM
+} prefetchKind;
+
+/*
+ * A stride table entry for region key, if valid. stride is the last
+ * nonzero step seen in the region, or 0 before there was one, and 
+ * confidence counts how often it repeated.
+ */
+typedef struct strideEntry{
+	int valid;
+	unsigned long long key;
+	unsigned long long last;
+	long long stride;
+	int confidence;
+} strideEntry;
+
+/*
+ * A stream. head is the line most recently demanded from it and next
+ * the next line it will fetch, dir steps from head towards next, and
+ * stamp orders streams by use so the oldest is replaced first.
+ */
+typedef struct stream{
+	unsigned long long head;
+	unsigned long long next;
+	int dir;
+	int valid;
+	unsigned long long stamp;
+} stream;
+
+/*
+ * Prefetcher state.
+ *  strides - the stride table
+ *  streams, misses - the streams and the ring of recent miss lines, of
+ *  		which the first missCount are real misses
+ *  polluted - lines evicted by a prefetch, plus one, by their hash
+ */
+struct prefetcher{
+	prefetchKind kind;
+	int b;
+	strideEntry strides[STRIDE_ENTRIES];
+	stream streams[STREAM_COUNT];
+	unsigned long long misses[MISS_HISTORY];
+	int missCursor;
+	int missCount;
+	unsigned long long clock;
+	unsigned long long polluted[POLLUTION_ENTRIES];
+};
+
+/* Hashes a line or region number into a table of 2^k entries given
+ * mask 2^k - 1 */
+static inline unsigned long long hashKey(unsigned long long key,
+										 unsigned long long mask){
+	return ((key * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+prefetcher* makePrefetcher(const char* kind, int b){
+	prefetchKind k;
+	if(strcmp(kind, "next") == 0){
+		k = PREFETCH_NEXT;
+	} else if(strcmp(kind, "stride") == 0){
+		k = PREFETCH_STRIDE;
+	} else if(strcmp(kind, "stream") == 0){
+		k = PREFETCH_STREAM;
+	} else {
+		return NULL;
+	}
+	prefetcher* pf = (prefetcher*) calloc(1, sizeof(prefetcher));
+	if(pf == NULL){
+		printf("Prefetcher allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	pf->kind = k;
+	pf->b = b;
+	return pf;
+}
+
+/* Trains the stride table on an access to line */
+static int strideAccess(prefetcher* pf, unsigned long long line,
+						unsigned long long* lines){
+	unsigned long long region = (pf->b >= STRIDE_REGION_BITS) ? line
+								: line >> (STRIDE_REGION_BITS - pf->b);
+	strideEntry* entry = &pf->strides[hashKey(region, STRIDE_ENTRIES - 1)];
+	if(!entry->valid || entry->key != region){
+		entry->valid = 1;
+		entry->key = region;
+		entry->last = line;
+		entry->stride = 0;
+		entry->confidence = 0;
+		return 0;
+	}
+
+	long long delta = (long long) (line - entry->last);
+	if(delta == 0){
+		return 0;
+	}
+	if(entry->stride != 0 && delta == entry->stride){
+		if(entry->confidence < 3){
+			entry->confidence++;
+		}
+	} else {
+		entry->stride = delta;
+		entry->confidence = 0;
+	}
+	entry->last = line;
+
+	if(entry->confidence == 0){
+		return 0;
+	}
+	for(int i = 0; i < PREFETCH_DEGREE; i++){
+		lines[i] = line + (unsigned long long) (entry->stride * (i + 1));
+	}
+	return PREFETCH_DEGREE;
+}
+
+/* Keeps s PREFETCH_DEPTH lines ahead of line, naming what it fetches */
+static int streamAdvance(prefetcher* pf, stream* s, unsigned long long line,
+						 unsigned long long* lines){
+	int count = 0;
+	s->head = line;
+	s->stamp = ++pf->clock;
+	while(count < PREFETCH_MAX &&
+		  (long long) (s->next - line) * s->dir <= PREFETCH_DEPTH){
+		lines[count++] = s->next;
+		s->next += s->dir;
+	}
+	return count;
+}
+
+/* Follows or starts a stream on a miss or a first prefetched hit */
+static int streamAccess(prefetcher* pf, unsigned long long line, int miss,
+						unsigned long long* lines){
+	/* A stream that has reached line moves on past it */
+	for(int i = 0; i < STREAM_COUNT; i++){
+		stream* s = &pf->streams[i];
+		if(!s->valid){
+			continue;
+		}
+		long long ahead = (long long) (line - s->head) * s->dir;
+		long long behind = (long long) (s->next - line) * s->dir;
+		if(ahead >= 0 && behind >= 0){
+			return streamAdvance(pf, s, line, lines);
+		}
+	}
+	if(!miss){
+		return 0;
+	}
+
+	/* Otherwise a miss next to a recent miss starts a new stream in
+	 * place of the least recently used one */
+	int dir = 0;
+	for(int i = 0; i < pf->missCount && dir == 0; i++){
+		if(line > 0 && pf->misses[i] == line - 1){
+			dir = 1;
+		} else if(pf->misses[i] == line + 1){
+			dir = -1;
+		}
+	}
+	pf->misses[pf->missCursor] = line;
+	pf->missCursor = (pf->missCursor + 1) % MISS_HISTORY;
+	if(pf->missCount < MISS_HISTORY){
+		pf->missCount++;
+	}
+	if(dir == 0){
+		return 0;
+	}
+
+	stream* oldest = &pf->streams[0];
+	for(int i = 1; i < STREAM_COUNT; i++){
+		if(!pf->streams[i].valid ||
+		   (oldest->valid && pf->streams[i].stamp < oldest->stamp)){
+			oldest = &pf->streams[i];
+		}
+	}
+	oldest->valid = 1;
+	oldest->dir = dir;
+	oldest->next = line + dir;
+	return streamAdvance(pf, oldest, line, lines);
+}
+
+int prefetchAccess(prefetcher* pf, unsigned long long line, int miss,
+				   int prefetchedHit, unsigned long long* lines){
+	switch(pf->kind){
+		case PREFETCH_NEXT:
+			if(miss || prefetchedHit){
+				lines[0] = line + 1;
+				return 1;
+			}
+			return 0;
+		case PREFETCH_STRIDE:
+			return strideAccess(pf, line, lines);
+		case PREFETCH_STREAM:
+			if(miss || prefetchedHit){
+				return streamAccess(pf, line, miss, lines);
+			}
+			return 0;
+	}
+	return 0;
+}
+
+void prefetchEvicted(prefetcher* pf, unsigned long long line){
+	pf->polluted[hashKey(line, POLLUTION_ENTRIES - 1)] = line + 1;
+}
+
+int prefetchPolluted(prefetcher* pf, unsigned long long line){
+	unsigned long long* entry = &pf->polluted[hashKey(line, POLLUTION_ENTRIES - 1)];
+	if(*entry != line + 1){
+		return 0;
+	}
+	*entry = 0;
+	return 1;
+}
+
+void freePrefetcher(prefetcher* pf){
+	free(pf);
+}
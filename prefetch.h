@@ -0,0 +1,52 @@
+/*
+ * prefetch.h - Prototypes for hardware prefetcher models
+ *
+ * A prefetcher watches the demand accesses of a cache, one line
+ * address (an address without its offset bits) at a time, and names
+ * the lines it would fetch ahead of them. The cache does the fetching,
+ * so the models only keep the state they learn from.
+ */
+
+#ifndef PREFETCH_TOOLS_H
+#define PREFETCH_TOOLS_H
+
+/* Most lines a prefetcher names for a single access */
+#define PREFETCH_MAX 8
+
+typedef struct prefetcher prefetcher;
+
+/*
+ * makePrefetcher - Creates a prefetcher for a cache with 2^b byte
+ * lines. kind is "next" for a next-line prefetcher, "stride" for a
+ * stride detector keyed by 4 KiB region, or "stream" for stream
+ * buffers. Returns NULL if kind is none of these.
+ */
+prefetcher* makePrefetcher(const char* kind, int b);
+
+/*
+ * prefetchAccess - Shows the prefetcher a demand access to line. miss
+ * is 1 if it missed, and prefetchedHit is 1 if it hit a line that was
+ * prefetched and not used before. Writes the lines to prefetch to
+ * lines and returns how many there are, at most PREFETCH_MAX.
+ */
+int prefetchAccess(prefetcher* pf, unsigned long long line, int miss,
+				   int prefetchedHit, unsigned long long* lines);
+
+/*
+ * prefetchEvicted - Remembers that a prefetch evicted line, so that a
+ * later miss on it can be blamed on the prefetcher.
+ */
+void prefetchEvicted(prefetcher* pf, unsigned long long line);
+
+/*
+ * prefetchPolluted - Returns 1 if line was recently evicted by a
+ * prefetch, and forgets it, or 0 otherwise.
+ */
+int prefetchPolluted(prefetcher* pf, unsigned long long line);
+
+/*
+ * freePrefetcher - Frees everything makePrefetcher allocated.
+ */
+void freePrefetcher(prefetcher* pf);
+
+#endif /* PREFETCH_TOOLS_H */
@@ -0,0 +1,245 @@
+/*
+ * regions.c - Attributing cache events to memory regions and sets
+ *
+ * Region counters live in an open addressing hash table keyed by the
+ * region number, so an access costs one multiply and usually a single
+ * probe. Consecutive accesses tend to hit the same region, so the
+ * entry of the previous access is tried before hashing at all. Set
+ * counters live in a second such table keyed by the set index, so that
+ * a cache of 2^28 sets costs nothing for the sets a run never touches.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "regions.h"
+
+/*
+ * Counters of one region or set. key is the region number or set index
+ * plus one, so that 0 marks an empty table entry.
+ */
+typedef struct regionCounter{
+	unsigned long long key;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+} regionCounter;
+
+/*
+ * An open addressing hash table of counters.
+ *  last - the entry of the previous access
+ */
+typedef struct counterTable{
+	regionCounter* table;
+	unsigned long long tableSize;
+	unsigned long long tableUsed;
+	unsigned long long last;
+} counterTable;
+
+/*
+ * Attribution state.
+ *  regions, sets - the counters of the regions and sets accessed so far
+ */
+struct regionStats{
+	int regionBits;
+	int s;
+	counterTable regions;
+	counterTable sets;
+};
+
+/* Hashes a region number into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashRegion(unsigned long long region,
+											unsigned long long mask){
+	return ((region * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table slot for id, claiming an empty one if needed */
+static unsigned long long findCounter(counterTable* t, unsigned long long id){
+	unsigned long long mask = t->tableSize - 1;
+	unsigned long long key = id + 1;
+	unsigned long long i = hashRegion(id, mask);
+	while(t->table[i].key != key && t->table[i].key != 0){
+		i = (i + 1) & mask;
+	}
+	if(t->table[i].key == 0){
+		t->table[i].key = key;
+		t->tableUsed++;
+	}
+	return i;
+}
+
+/* Returns whether t has counters for id */
+static int hasCounter(counterTable* t, unsigned long long id){
+	unsigned long long mask = t->tableSize - 1;
+	unsigned long long i = hashRegion(id, mask);
+	while(t->table[i].key != id + 1 && t->table[i].key != 0){
+		i = (i + 1) & mask;
+	}
+	return t->table[i].key != 0;
+}
+
+/* Creates an empty table of 1024 entries */
+static void initCounters(counterTable* t){
+	t->tableSize = 1024;
+	t->tableUsed = 0;
+	t->last = 0;
+	t->table = (regionCounter*) calloc(t->tableSize, sizeof(regionCounter));
+	if(t->table == NULL){
+		printf("Region table allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Doubles the size of the hash table */
+static void growCounters(counterTable* t){
+	regionCounter* old = t->table;
+	unsigned long long oldSize = t->tableSize;
+	t->tableSize *= 2;
+	t->tableUsed = 0;
+	t->table = (regionCounter*) calloc(t->tableSize, sizeof(regionCounter));
+	if(t->table == NULL){
+		printf("Region table allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for(unsigned long long i = 0; i < oldSize; i++){
+		if(old[i].key != 0){
+			t->table[findCounter(t, old[i].key - 1)] = old[i];
+		}
+	}
+	free(old);
+	t->last = 0;
+}
+
+/* Adds hits, misses and evictions to the counters of id */
+static inline void addCounts(counterTable* t, unsigned long long id,
+							 int hits, int misses, int evictions){
+	regionCounter* counter = &t->table[t->last];
+	if(counter->key != id + 1){
+		/* Keep the table at most half full so probes stay short */
+		if(2 * (t->tableUsed + 1) > t->tableSize){
+			growCounters(t);
+		}
+		t->last = findCounter(t, id);
+		counter = &t->table[t->last];
+	}
+	counter->hits += hits;
+	counter->misses += misses;
+	counter->evictions += evictions;
+}
+
+regionStats* makeRegionStats(int regionBits, int s){
+	regionStats* stats = (regionStats*) calloc(1, sizeof(regionStats));
+	if(stats == NULL){
+		printf("Region table allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	stats->regionBits = regionBits;
+	stats->s = s;
+	initCounters(&stats->regions);
+	initCounters(&stats->sets);
+	return stats;
+}
+
+void regionRecord(regionStats* stats, unsigned long long address,
+				  unsigned long long index, int hits, int misses,
+				  int evictions){
+	addCounts(&stats->regions, address >> stats->regionBits, hits, misses, evictions);
+	addCounts(&stats->sets, index, hits, misses, evictions);
+}
+
+/* Copies the used entries of t into a new array, keyed by id again,
+ * with room for extra more, and sets *count to how many there were */
+static regionCounter* gatherCounters(counterTable* t, unsigned long long extra,
+									 unsigned long long* count){
+	regionCounter* counters = (regionCounter*) malloc(sizeof(regionCounter) *
+													  (t->tableUsed + extra + 1));
+	*count = 0;
+	for(unsigned long long i = 0; i < t->tableSize; i++){
+		if(t->table[i].key != 0){
+			counters[*count] = t->table[i];
+			counters[*count].key -= 1;
+			(*count)++;
+		}
+	}
+	return counters;
+}
+
+/* Orders counters by misses, most first, then by key */
+static int byMisses(const void* a, const void* b){
+	const regionCounter* x = (const regionCounter*) a;
+	const regionCounter* y = (const regionCounter*) b;
+	if(x->misses != y->misses){
+		return x->misses < y->misses ? 1 : -1;
+	}
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* Orders counters by evictions, most first, then by misses */
+static int byEvictions(const void* a, const void* b){
+	const regionCounter* x = (const regionCounter*) a;
+	const regionCounter* y = (const regionCounter*) b;
+	if(x->evictions != y->evictions){
+		return x->evictions < y->evictions ? 1 : -1;
+	}
+	return byMisses(a, b);
+}
+
+void regionWrite(regionStats* stats, FILE* out, int json){
+	/* Gather the used table entries and sort them */
+	unsigned long long count;
+	regionCounter* regions = gatherCounters(&stats->regions, 0, &count);
+	qsort(regions, count, sizeof(regionCounter), byMisses);
+	unsigned long long setCount = (stats->s >= 64) ? ~0ULL : 1ULL << stats->s;
+	unsigned long long used;
+	regionCounter* sets = gatherCounters(&stats->sets, REGION_TOP, &used);
+
+	/* Sets that were never touched have no counters, but the lowest of 
+	 * them still make the list if too few sets stand out, as they would
+	 * in a sort of every set */
+	unsigned long long untouched = 0;
+	for(unsigned long long i = 0; untouched < REGION_TOP && i < setCount; i++){
+		if(!hasCounter(&stats->sets, i)){
+			sets[used++] = (regionCounter) { i, 0, 0, 0 };
+			untouched++;
+		}
+	}
+	qsort(sets, used, sizeof(regionCounter), byEvictions);
+
+	unsigned long long topRegions = count < REGION_TOP ? count : REGION_TOP;
+	unsigned long long topSets = setCount < REGION_TOP ? setCount : REGION_TOP;
+
+	if(json){
+		fprintf(out, "{\n  \"regionBytes\": %llu,\n  \"regions\": [",
+				1ULL << stats->regionBits);
+		for(unsigned long long i = 0; i < topRegions; i++){
+			fprintf(out, "%s\n    {\"base\": \"0x%llx\", \"hits\": %llu, "
+					"\"misses\": %llu, \"evictions\": %llu}", i ? "," : "",
+					regions[i].key << stats->regionBits, regions[i].hits,
+					regions[i].misses, regions[i].evictions);
+		}
+		fprintf(out, "\n  ],\n  \"sets\": [");
+		for(unsigned long long i = 0; i < topSets; i++){
+			fprintf(out, "%s\n    {\"index\": %llu, \"hits\": %llu, "
+					"\"misses\": %llu, \"evictions\": %llu}", i ? "," : "",
+					sets[i].key, sets[i].hits, sets[i].misses, sets[i].evictions);
+		}
+		fprintf(out, "\n  ]\n}\n");
+	} else {
+		fprintf(out, "kind,id,hits,misses,evictions\n");
+		for(unsigned long long i = 0; i < topRegions; i++){
+			fprintf(out, "region,0x%llx,%llu,%llu,%llu\n",
+					regions[i].key << stats->regionBits, regions[i].hits,
+					regions[i].misses, regions[i].evictions);
+		}
+		for(unsigned long long i = 0; i < topSets; i++){
+			fprintf(out, "set,%llu,%llu,%llu,%llu\n", sets[i].key,
+					sets[i].hits, sets[i].misses, sets[i].evictions);
+		}
+	}
+	free(regions);
+	free(sets);
+}
+
+void freeRegionStats(regionStats* stats){
+	free(stats->regions.table);
+	free(stats->sets.table);
+	free(stats);
+}
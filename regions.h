@@ -0,0 +1,42 @@
+/*
+ * regions.h - Prototypes for attributing cache events to memory
+ * regions and cache sets
+ */
+
+#ifndef REGIONS_TOOLS_H
+#define REGIONS_TOOLS_H
+
+#include <stdio.h>
+
+/* Number of regions and of sets reported by regionWrite */
+#define REGION_TOP 50
+
+typedef struct regionStats regionStats;
+
+/*
+ * makeRegionStats - Creates counters for regions of 2^regionBits
+ * bytes and for the 2^s sets of a cache.
+ */
+regionStats* makeRegionStats(int regionBits, int s);
+
+/*
+ * regionRecord - Adds hits, misses and evictions caused by an access
+ * to address, which maps to cache set index.
+ */
+void regionRecord(regionStats* stats, unsigned long long address,
+				  unsigned long long index, int hits, int misses,
+				  int evictions);
+
+/*
+ * regionWrite - Writes the REGION_TOP regions with the most misses
+ * and the REGION_TOP sets with the most evictions to out, as JSON if
+ * json is 1 and as CSV otherwise.
+ */
+void regionWrite(regionStats* stats, FILE* out, int json);
+
+/*
+ * freeRegionStats - Frees everything makeRegionStats allocated.
+ */
+void freeRegionStats(regionStats* stats);
+
+#endif /* REGIONS_TOOLS_H */
@@ -0,0 +1,422 @@
+/*
+ * shards.c - SHARDS sampled miss ratio curves in constant memory
+ *
+ * The sampled lines' stack distances are counted like in stackdist.c:
+ * every sampled access gets a slot on a timeline, each line keeps a
+ * mark at the slot of its latest access, and a Fenwick tree counts the
+ * marks after a line's previous slot. Since at most budget lines are
+ * ever sampled at once, the timeline, the hash table of sampled lines
+ * and the max-heap that finds the line to drop when the threshold is
+ * lowered all have a fixed size.
+ *
+ * Distances are scaled by the sampling rate into a histogram with one
+ * bucket per power of two, which is all a curve over cache sizes of
+ * 2^k lines needs. A sampled distance d only says that the real one
+ * is somewhere in the 1 / rate distances up to d / rate, that is in
+ * [(d - 1) / rate + 1, d / rate + 1), so each access is spread evenly
+ * over that range instead of counted at one end of it, which would
+ * make caches smaller than 1 / rate lines look far better or worse
+ * than they are. The exception is an access to the same line as the
+ * access just before it, whose distance is known to be 0.
+ *
+ * When the rate drops, the histogram is scaled down with it so that
+ * older and newer samples weigh the same. On skewed traces the number
+ * of sampled accesses still differs from the rate's share of all of
+ * them, depending on whether a few hot lines land in the sample. The
+ * paper's SHARDS_adj counts that difference as hits in every cache,
+ * which makes caches smaller than the hot lines' own reuse distances
+ * look far better than they are. Since hot lines are the ones reused
+ * soonest, the difference is instead counted as the shortest reuses
+ * of the trace, spread like the sampled reuses up to the quantile it
+ * makes up of all of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "shards.h"
+
+/* Hashes are taken modulo 2^SHARDS_BITS, so rates are multiples of
+ * 2^-SHARDS_BITS */
+#define SHARDS_BITS 24
+#define SHARDS_MODULUS (1U << SHARDS_BITS)
+
+/* Histogram buckets: 0 for distances below 1, then k for [2^(k-1), 2^k) */
+#define SHARDS_BUCKETS 65
+
+/* Groups the sampled lines are split into by hash for the error */
+#define SHARDS_GROUPS 16
+
+/*
+ * A sampled line. key is the line address plus one, so that 0 marks
+ * an empty table entry, and slot is its mark on the timeline.
+ */
+typedef struct sampledLine{
+	unsigned long long key;
+	unsigned int hash;
+	unsigned int slot;
+} sampledLine;
+
+/* A heap entry, ordered by hash */
+typedef struct heapEntry{
+	unsigned int hash;
+	unsigned long long line;
+} heapEntry;
+
+/*
+ * Sampler state.
+ *  threshold - lines whose hash is below it are sampled
+ *  table - open addressing hash table of the sampled lines
+ *  heap - max-heap of the sampled lines by hash
+ *  tree, lines, capacity, next, live - the timeline, as in stackdist.c
+ *  histogram, cold - sampled accesses by scaled stack distance, and
+ *  		sampled first accesses, all scaled to the current rate and
+ *  		kept apart for each group of sampled lines
+ *  accesses, lastLine - # of accesses seen, sampled or not, and the
+ *  		line of the latest one
+ */
+struct shards{
+	int budget;
+	unsigned long long salt;
+	unsigned int threshold;
+	sampledLine* table;
+	unsigned long long tableSize;
+	heapEntry* heap;
+	int heapUsed;
+	unsigned int* tree;
+	unsigned long long* lines;
+	unsigned int capacity;
+	unsigned int next;
+	unsigned int live;
+	double histogram[SHARDS_GROUPS][SHARDS_BUCKETS];
+	double cold[SHARDS_GROUPS];
+	unsigned long long accesses;
+	unsigned long long lastLine;
+};
+
+/* Hashes a line address into SHARDS_BITS bits (the splitmix64 mixer) */
+static inline unsigned int sampleHash(unsigned long long line,
+									  unsigned long long salt){
+	unsigned long long z = line + salt * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return (unsigned int) (z & (SHARDS_MODULUS - 1));
+}
+
+/* Hashes a line address into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashSampled(unsigned long long line,
+											 unsigned long long mask){
+	return ((line * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table slot of line, or the empty slot it would take */
+static inline unsigned long long sampledSlot(shards* sh, unsigned long long line){
+	unsigned long long mask = sh->tableSize - 1;
+	unsigned long long i = hashSampled(line, mask);
+	while(sh->table[i].key != 0 && sh->table[i].key != line + 1){
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/*
+ * Removes the entry at table slot i, moving later entries of the same
+ * probe run back so that lookups never stop short of them.
+ */
+static void removeSampled(shards* sh, unsigned long long i){
+	unsigned long long mask = sh->tableSize - 1;
+	unsigned long long j = i;
+	while(1){
+		j = (j + 1) & mask;
+		if(sh->table[j].key == 0){
+			break;
+		}
+		unsigned long long home = hashSampled(sh->table[j].key - 1, mask);
+		/* Entry j may fill the hole at i unless its home lies in (i, j] */
+		if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)){
+			sh->table[i] = sh->table[j];
+			i = j;
+		}
+	}
+	sh->table[i].key = 0;
+}
+
+/* Adds delta to slot in the Fenwick tree */
+static inline void treeAdd(shards* sh, unsigned int slot, int delta){
+	for(; slot <= sh->capacity; slot += slot & -slot){
+		sh->tree[slot] += delta;
+	}
+}
+
+/* Returns the number of marks in slots 1..slot */
+static inline unsigned int treePrefix(shards* sh, unsigned int slot){
+	unsigned int sum = 0;
+	for(; slot > 0; slot -= slot & -slot){
+		sum += sh->tree[slot];
+	}
+	return sum;
+}
+
+/* Renumbers the live marks to slots 1..live, keeping their order */
+static void compactTimeline(shards* sh){
+	unsigned int live = 0;
+	for(unsigned int slot = 1; slot < sh->next; slot++){
+		unsigned long long i = sampledSlot(sh, sh->lines[slot]);
+		if(sh->table[i].key != 0 && sh->table[i].slot == slot){
+			sh->table[i].slot = ++live;
+			sh->lines[live] = sh->lines[slot];
+		}
+	}
+	memset(sh->tree, 0, sizeof(unsigned int) * (sh->capacity + 1));
+	for(unsigned int slot = 1; slot <= sh->capacity; slot++){
+		if(slot <= live){
+			sh->tree[slot] += 1;
+		}
+		unsigned int parent = slot + (slot & -slot);
+		if(parent <= sh->capacity){
+			sh->tree[parent] += sh->tree[slot];
+		}
+	}
+	sh->next = live + 1;
+	sh->live = live;
+}
+
+/* Adds a line to the max-heap */
+static void heapPush(shards* sh, unsigned int hash, unsigned long long line){
+	int i = sh->heapUsed++;
+	while(i > 0 && sh->heap[(i - 1) / 2].hash < hash){
+		sh->heap[i] = sh->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	sh->heap[i].hash = hash;
+	sh->heap[i].line = line;
+}
+
+/* Removes the line with the largest hash from the max-heap */
+static void heapPop(shards* sh){
+	heapEntry last = sh->heap[--sh->heapUsed];
+	int i = 0;
+	while(1){
+		int child = 2 * i + 1;
+		if(child >= sh->heapUsed){
+			break;
+		}
+		if(child + 1 < sh->heapUsed && sh->heap[child + 1].hash > sh->heap[child].hash){
+			child++;
+		}
+		if(sh->heap[child].hash <= last.hash){
+			break;
+		}
+		sh->heap[i] = sh->heap[child];
+		i = child;
+	}
+	sh->heap[i] = last;
+}
+
+/*
+ * Lowers the threshold to the largest sampled hash and drops every line
+ * at or above it, scaling the histogram down with the rate.
+ */
+static void lowerThreshold(shards* sh){
+	unsigned int threshold = sh->heap[0].hash;
+	while(sh->heapUsed > 0 && sh->heap[0].hash >= threshold){
+		unsigned long long i = sampledSlot(sh, sh->heap[0].line);
+		treeAdd(sh, sh->table[i].slot, -1);
+		sh->live--;
+		removeSampled(sh, i);
+		heapPop(sh);
+	}
+	double scale = (double) threshold / sh->threshold;
+	for(int g = 0; g < SHARDS_GROUPS; g++){
+		for(int k = 0; k < SHARDS_BUCKETS; k++){
+			sh->histogram[g][k] *= scale;
+		}
+		sh->cold[g] *= scale;
+	}
+	sh->threshold = threshold;
+}
+
+/*
+ * Adds one access whose scaled distance lies evenly in [low, high) to
+ * histogram, split between the buckets the range overlaps.
+ */
+static void spreadDistance(double* histogram, double low, double high){
+	double width = high - low;
+	double bucketLow = 0;
+	double bucketHigh = 1;
+	for(int k = 0; k < SHARDS_BUCKETS && bucketLow < high; k++){
+		if(k == SHARDS_BUCKETS - 1){
+			bucketHigh = high;
+		}
+		double from = low > bucketLow ? low : bucketLow;
+		double to = high < bucketHigh ? high : bucketHigh;
+		if(to > from){
+			histogram[k] += (to - from) / width;
+		}
+		bucketLow = bucketHigh;
+		bucketHigh *= 2;
+	}
+}
+
+shards* makeShards(int budget, unsigned long long salt){
+	shards* sh = (shards*) calloc(1, sizeof(shards));
+	if(sh == NULL){
+		printf("SHARDS allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	sh->budget = budget;
+	sh->salt = salt;
+	sh->threshold = SHARDS_MODULUS;
+	/* The table is at most a quarter full, and the timeline is only
+	 * compacted after four slots per sampled line were used */
+	sh->tableSize = 4;
+	while(sh->tableSize < 4ULL * (budget + 1)){
+		sh->tableSize *= 2;
+	}
+	sh->capacity = 4 * (budget + 1);
+	sh->next = 1;
+	sh->table = (sampledLine*) calloc(sh->tableSize, sizeof(sampledLine));
+	sh->heap = (heapEntry*) malloc(sizeof(heapEntry) * (budget + 1));
+	sh->tree = (unsigned int*) calloc(sh->capacity + 1, sizeof(unsigned int));
+	sh->lines = (unsigned long long*) malloc(sizeof(unsigned long long) * (sh->capacity + 1));
+	if(sh->table == NULL || sh->heap == NULL || sh->tree == NULL || sh->lines == NULL){
+		printf("SHARDS allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	return sh;
+}
+
+void shardsAccess(shards* sh, unsigned long long line){
+	int repeat = sh->accesses > 0 && line == sh->lastLine;
+	sh->accesses++;
+	sh->lastLine = line;
+	unsigned int hash = sampleHash(line, sh->salt);
+	if(hash >= sh->threshold){
+		return;
+	}
+
+	unsigned long long i = sampledSlot(sh, line);
+	if(sh->table[i].key != 0){
+		/* Every mark after the previous slot is a distinct sampled line,
+		 * which stands for 1 / rate lines of the whole trace. Unless the
+		 * line was accessed just before, at least one line came between. */
+		unsigned int distance = sh->live - treePrefix(sh, sh->table[i].slot);
+		double unit = (double) SHARDS_MODULUS / sh->threshold;
+		double* histogram = sh->histogram[hash % SHARDS_GROUPS];
+		if(repeat){
+			histogram[0] += 1;
+		} else {
+			double low = ((double) distance - 1) * unit + 1;
+			double high = low + unit;
+			low = low < 1 ? 1 : low;
+			high = high <= low ? low + 1 : high;
+			spreadDistance(histogram, low, high);
+		}
+		treeAdd(sh, sh->table[i].slot, -1);
+		sh->live--;
+		sh->table[i].slot = 0;
+	} else {
+		sh->cold[hash % SHARDS_GROUPS] += 1;
+		sh->table[i].key = line + 1;
+		sh->table[i].hash = hash;
+		heapPush(sh, hash, line);
+	}
+
+	if(sh->next > sh->capacity){
+		compactTimeline(sh);
+		i = sampledSlot(sh, line);
+	}
+	sh->table[i].slot = sh->next++;
+	sh->lines[sh->table[i].slot] = line;
+	treeAdd(sh, sh->table[i].slot, 1);
+	sh->live++;
+
+	if(sh->heapUsed > sh->budget){
+		lowerThreshold(sh);
+	}
+}
+
+/*
+ * Returns the miss ratio of 2^k lines given the sampled accesses, the
+ * hits and all reuses among them, and the accesses the rate predicts.
+ */
+static inline double missRatio(double sampled, double hits, double reuses, 
+							   double expected){
+	if(sampled <= 0){
+		return 0.0;
+	}
+	double missing = expected - sampled;
+	if(reuses > 0 && missing != 0){
+		/* Too few sampled accesses add the missing ones to the shortest
+		 * reuses, and too many take the surplus away from them */
+		double magnitude = missing < 0 ? -missing : missing;
+		double shortest = magnitude / (reuses + (missing > 0 ? missing : 0));
+		double share = hits / reuses / shortest;
+		hits += missing * (share > 1 ? 1 : share);
+		sampled = expected;
+	}
+	double ratio = 1.0 - hits / sampled;
+	return ratio < 0.0 ? 0.0 : ratio > 1.0 ? 1.0 : ratio;
+}
+
+double shardsMissRatio(shards* sh, int k, double* error){
+	double sampled[SHARDS_GROUPS];
+	double hits[SHARDS_GROUPS];
+	double reuses[SHARDS_GROUPS];
+	double allSampled = 0;
+	double allHits = 0;
+	double allReuses = 0;
+	for(int g = 0; g < SHARDS_GROUPS; g++){
+		sampled[g] = sh->cold[g];
+		hits[g] = 0;
+		for(int j = 0; j < SHARDS_BUCKETS; j++){
+			sampled[g] += sh->histogram[g][j];
+			if(j <= k){
+				hits[g] += sh->histogram[g][j];
+			}
+		}
+		reuses[g] = sampled[g] - sh->cold[g];
+		allSampled += sampled[g];
+		allHits += hits[g];
+		allReuses += reuses[g];
+	}
+
+	/* The groups are independent samples of lines, so leaving each one
+	 * out in turn shows how much the estimate depends on which lines
+	 * were sampled (the delete-a-group jackknife). The less of the 
+	 * trace's lines are left out of the sample, the less that matters,
+	 * down to not at all when every line is sampled. */
+	double rate = (double) sh->threshold / SHARDS_MODULUS;
+	double expected = sh->accesses * rate;
+	double without[SHARDS_GROUPS];
+	double mean = 0;
+	for(int g = 0; g < SHARDS_GROUPS; g++){
+		without[g] = missRatio(allSampled - sampled[g], allHits - hits[g], 
+							   allReuses - reuses[g], 
+							   expected * (SHARDS_GROUPS - 1) / SHARDS_GROUPS);
+		mean += without[g] / SHARDS_GROUPS;
+	}
+	double variance = 0;
+	for(int g = 0; g < SHARDS_GROUPS; g++){
+		variance += (without[g] - mean) * (without[g] - mean);
+	}
+	*error = sqrt(variance * (SHARDS_GROUPS - 1) / SHARDS_GROUPS * (1.0 - rate));
+	return missRatio(allSampled, allHits, allReuses, expected);
+}
+
+double shardsDistinct(shards* sh){
+	double cold = 0;
+	for(int g = 0; g < SHARDS_GROUPS; g++){
+		cold += sh->cold[g];
+	}
+	return cold * SHARDS_MODULUS / sh->threshold;
+}
+
+void freeShards(shards* sh){
+	free(sh->table);
+	free(sh->heap);
+	free(sh->tree);
+	free(sh->lines);
+	free(sh);
+}
@@ -0,0 +1,49 @@
+/*
+ * shards.h - Prototypes for SHARDS sampled miss ratio curves
+ *
+ * SHARDS (Waldspurger et al., FAST '15) estimates the stack distances
+ * of a trace from the accesses to a spatially hashed sample of its
+ * lines: a line is sampled if the hash of its address is below a
+ * threshold, and every distance seen in the sample is scaled up by
+ * the sampling rate. Lowering the threshold whenever more than a fixed
+ * budget of lines is sampled keeps the memory used constant however
+ * long the trace or large its footprint.
+ */
+
+#ifndef SHARDS_TOOLS_H
+#define SHARDS_TOOLS_H
+
+typedef struct shards shards;
+
+/*
+ * makeShards - Creates a sampler that follows at most budget lines,
+ * hashing line addresses with salt so that samplers with different
+ * salts pick independent samples.
+ */
+shards* makeShards(int budget, unsigned long long salt);
+
+/*
+ * shardsAccess - Records an access to the line with line address line
+ * (the address without its offset bits).
+ */
+void shardsAccess(shards* sh, unsigned long long line);
+
+/*
+ * shardsMissRatio - Returns the estimated miss ratio of a fully
+ * associative LRU cache of 2^k lines, and sets *error to its standard
+ * error.
+ */
+double shardsMissRatio(shards* sh, int k, double* error);
+
+/*
+ * shardsDistinct - Returns the estimated number of distinct lines
+ * accessed so far.
+ */
+double shardsDistinct(shards* sh);
+
+/*
+ * freeShards - Frees everything makeShards allocated.
+ */
+void freeShards(shards* sh);
+
+#endif /* SHARDS_TOOLS_H */
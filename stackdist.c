@@ -0,0 +1,309 @@
+/*
+ * stackdist.c - Mattson stack distance analysis
+ *
+ * Rather than keeping an explicit LRU stack, which costs O(distance)
+ * per access, every access is given a slot on a timeline and each line
+ * only keeps a mark at the slot of its most recent access. The stack
+ * distance of an access is then the number of marks after the line's
+ * previous slot, which a Fenwick tree over the slots counts in
+ * O(log n). Each set has its own timeline, and one more timeline
+ * covering every line answers the fully associative case.
+ *
+ * Timelines only grow as far as needed: once a timeline runs out of
+ * slots its live marks are renumbered to the front, so the memory used
+ * is proportional to the number of distinct lines, not the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stackdist.h"
+
+/* Capacity of a timeline when its set is first touched */
+#define TIMELINE_MIN 8
+
+/*
+ * A timeline of slots.
+ *  tree - Fenwick tree over slots 1..capacity, 1 where a line's most
+ *  		recent access is
+ *  lines - the line that was accessed at each slot
+ *  next - the next unused slot
+ *  live - the number of marks in the tree
+ *  distinct - the number of distinct lines ever seen on this timeline
+ */
+typedef struct timeline{
+	unsigned int* tree;
+	unsigned long long* lines;
+	unsigned int capacity;
+	unsigned int next;
+	unsigned int live;
+	unsigned long long distinct;
+} timeline;
+
+/*
+ * A line's most recent slot on its set's timeline and on the fully
+ * associative timeline. Slot 0 means the line has no mark. key is the
+ * line address plus one, so that 0 marks an empty table entry.
+ */
+typedef struct lineEntry{
+	unsigned long long key;
+	unsigned int setSlot;
+	unsigned int fullSlot;
+} lineEntry;
+
+/*
+ * Analysis state.
+ *  sets, full - the per set timelines and the fully associative one
+ *  table - open addressing hash table from line to lineEntry
+ *  setHits[d] - # of accesses at stack distance d within their set,
+ *  		for d < maxE
+ *  fullHits[k] - # of accesses whose fully associative stack distance
+ *  		d satisfies k * 2^s <= d < (k + 1) * 2^s, for k < maxE
+ *  accesses - # of accesses recorded
+ */
+struct stackDist{
+	int s;
+	int maxE;
+	timeline* sets;
+	timeline full;
+	lineEntry* table;
+	unsigned long long tableSize;
+	unsigned long long tableUsed;
+	unsigned long long* setHits;
+	unsigned long long* fullHits;
+	unsigned long long accesses;
+};
+
+/* Hashes a line address into a table of 2^k entries given mask 2^k - 1 */
+static inline unsigned long long hashLine(unsigned long long line,
+										  unsigned long long mask){
+	return ((line * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+/* Returns the table entry for line, or NULL if it was never seen */
+static lineEntry* findLine(stackDist* sd, unsigned long long line){
+	unsigned long long mask = sd->tableSize - 1;
+	unsigned long long key = line + 1;
+	for(unsigned long long i = hashLine(line, mask); ; i = (i + 1) & mask){
+		if(sd->table[i].key == key){
+			return &sd->table[i];
+		}
+		if(sd->table[i].key == 0){
+			return NULL;
+		}
+	}
+}
+
+/* Inserts line into the table, which must have room for it */
+static lineEntry* insertLine(stackDist* sd, unsigned long long line){
+	unsigned long long mask = sd->tableSize - 1;
+	unsigned long long i = hashLine(line, mask);
+	while(sd->table[i].key != 0){
+		i = (i + 1) & mask;
+	}
+	sd->table[i].key = line + 1;
+	sd->table[i].setSlot = 0;
+	sd->table[i].fullSlot = 0;
+	sd->tableUsed++;
+	return &sd->table[i];
+}
+
+/* Doubles the size of the hash table */
+static void growTable(stackDist* sd){
+	lineEntry* old = sd->table;
+	unsigned long long oldSize = sd->tableSize;
+	sd->tableSize *= 2;
+	sd->tableUsed = 0;
+	sd->table = (lineEntry*) calloc(sd->tableSize, sizeof(lineEntry));
+	for(unsigned long long i = 0; i < oldSize; i++){
+		if(old[i].key != 0){
+			lineEntry* entry = insertLine(sd, old[i].key - 1);
+			entry->setSlot = old[i].setSlot;
+			entry->fullSlot = old[i].fullSlot;
+		}
+	}
+	free(old);
+}
+
+/* Adds delta to slot in the Fenwick tree */
+static inline void treeAdd(timeline* t, unsigned int slot, int delta){
+	for(; slot <= t->capacity; slot += slot & -slot){
+		t->tree[slot] += delta;
+	}
+}
+
+/* Returns the number of marks in slots 1..slot */
+static inline unsigned int treePrefix(timeline* t, unsigned int slot){
+	unsigned int sum = 0;
+	for(; slot > 0; slot -= slot & -slot){
+		sum += t->tree[slot];
+	}
+	return sum;
+}
+
+/*
+ * Renumbers the live marks of t to slots 1..live, keeping their order,
+ * and grows t if that would leave it more than half full. full says
+ * which of the two slots of a lineEntry belongs to this timeline.
+ */
+static void compactTimeline(stackDist* sd, timeline* t, int full){
+	unsigned int live = 0;
+	for(unsigned int slot = 1; slot < t->next; slot++){
+		lineEntry* entry = findLine(sd, t->lines[slot]);
+		unsigned int* mark = full ? &entry->fullSlot : &entry->setSlot;
+		if(*mark == slot){
+			*mark = ++live;
+			t->lines[live] = t->lines[slot];
+		}
+	}
+
+	if(t->capacity < 2 * live || t->capacity < TIMELINE_MIN){
+		unsigned int capacity = t->capacity < TIMELINE_MIN ?
+									TIMELINE_MIN : 2 * t->capacity;
+		while(capacity < 2 * live){
+			capacity *= 2;
+		}
+		t->capacity = capacity;
+		t->lines = (unsigned long long*) realloc(t->lines,
+						sizeof(unsigned long long) * (capacity + 1));
+		t->tree = (unsigned int*) realloc(t->tree,
+						sizeof(unsigned int) * (capacity + 1));
+	}
+
+	/* Rebuild the tree with a mark in each of the first live slots */
+	memset(t->tree, 0, sizeof(unsigned int) * (t->capacity + 1));
+	for(unsigned int slot = 1; slot <= t->capacity; slot++){
+		if(slot <= live){
+			t->tree[slot] += 1;
+		}
+		unsigned int parent = slot + (slot & -slot);
+		if(parent <= t->capacity){
+			t->tree[parent] += t->tree[slot];
+		}
+	}
+	t->next = live + 1;
+	t->live = live;
+}
+
+/*
+ * Records an access to line on timeline t, moving the line's mark in
+ * entry to a new slot at the end of t. Returns the stack distance of
+ * the access, or -1 if this is the line's first access on t.
+ */
+static long long touch(stackDist* sd, timeline* t, unsigned long long line,
+					   lineEntry* entry, int full){
+	unsigned int* slot = full ? &entry->fullSlot : &entry->setSlot;
+	long long distance = -1;
+	if(*slot == 0){
+		t->distinct++;
+	} else {
+		/* Every mark after the previous slot is a distinct line */
+		distance = t->live - treePrefix(t, *slot);
+		treeAdd(t, *slot, -1);
+		t->live--;
+		*slot = 0;
+	}
+
+	if(t->next > t->capacity || t->capacity == 0){
+		compactTimeline(sd, t, full);
+	}
+	*slot = t->next++;
+	t->lines[*slot] = line;
+	treeAdd(t, *slot, 1);
+	t->live++;
+	return distance;
+}
+
+stackDist* makeStackDist(int s, int maxE){
+	stackDist* sd = (stackDist*) calloc(1, sizeof(stackDist));
+	if(sd == NULL){
+		printf("Stack distance allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	sd->s = s;
+	sd->maxE = maxE;
+	sd->sets = (timeline*) calloc(1ULL << s, sizeof(timeline));
+	sd->tableSize = 1024;
+	sd->table = (lineEntry*) calloc(sd->tableSize, sizeof(lineEntry));
+	sd->setHits = (unsigned long long*) calloc(maxE, sizeof(unsigned long long));
+	sd->fullHits = (unsigned long long*) calloc(maxE, sizeof(unsigned long long));
+	if(sd->sets == NULL || sd->table == NULL){
+		printf("Stack distance allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	return sd;
+}
+
+void stackDistAccess(stackDist* sd, unsigned long long line,
+					 unsigned long long index){
+	lineEntry* entry = findLine(sd, line);
+	if(entry == NULL){
+		/* Keep the table at most half full so probes stay short */
+		if(2 * (sd->tableUsed + 1) > sd->tableSize){
+			growTable(sd);
+		}
+		entry = insertLine(sd, line);
+	}
+	sd->accesses++;
+
+	long long distance = touch(sd, &sd->sets[index], line, entry, 0);
+	if(distance >= 0 && distance < sd->maxE){
+		sd->setHits[distance]++;
+	}
+
+	/* Growing a timeline never moves table entries, so entry is still
+	 * valid here */
+	distance = touch(sd, &sd->full, line, entry, 1);
+	if(distance >= 0){
+		unsigned long long bucket = (unsigned long long) distance >> sd->s;
+		if(bucket < (unsigned long long) sd->maxE){
+			sd->fullHits[bucket]++;
+		}
+	}
+}
+
+void stackDistResults(stackDist* sd, int E, unsigned long long* hits,
+					  unsigned long long* misses,
+					  unsigned long long* evictions){
+	*hits = 0;
+	for(int d = 0; d < E; d++){
+		*hits += sd->setHits[d];
+	}
+	*misses = sd->accesses - *hits;
+
+	/* Every miss evicts something unless it fills one of the E lines
+	 * of its set for the first time */
+	unsigned long long fills = 0;
+	for(unsigned long long i = 0; i < (1ULL << sd->s); i++){
+		fills += sd->sets[i].distinct < (unsigned long long) E ?
+					sd->sets[i].distinct : (unsigned long long) E;
+	}
+	*evictions = *misses - fills;
+}
+
+void stackDistFullResults(stackDist* sd, int E, unsigned long long* hits,
+						  unsigned long long* misses,
+						  unsigned long long* evictions){
+	*hits = 0;
+	for(int k = 0; k < E; k++){
+		*hits += sd->fullHits[k];
+	}
+	*misses = sd->accesses - *hits;
+
+	unsigned long long lines = (unsigned long long) E << sd->s;
+	unsigned long long fills = sd->full.distinct < lines ? sd->full.distinct : lines;
+	*evictions = *misses - fills;
+}
+
+void freeStackDist(stackDist* sd){
+	for(unsigned long long i = 0; i < (1ULL << sd->s); i++){
+		free(sd->sets[i].tree);
+		free(sd->sets[i].lines);
+	}
+	free(sd->sets);
+	free(sd->full.tree);
+	free(sd->full.lines);
+	free(sd->table);
+	free(sd->setHits);
+	free(sd->fullHits);
+	free(sd);
+}
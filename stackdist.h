@@ -0,0 +1,51 @@
+/*
+ * stackdist.h - Prototypes for Mattson stack distance analysis
+ *
+ * An LRU cache with E lines per set hits exactly on the accesses whose
+ * stack distance (the number of distinct lines of the same set touched
+ * since the previous access to the line) is less than E. Recording
+ * every access's stack distance once therefore answers the hit count
+ * for every associativity at the same time.
+ */
+
+#ifndef STACKDIST_TOOLS_H
+#define STACKDIST_TOOLS_H
+
+typedef struct stackDist stackDist;
+
+/*
+ * makeStackDist - Creates an analysis of a cache with 2^s sets for
+ * every associativity from 1 to maxE.
+ */
+stackDist* makeStackDist(int s, int maxE);
+
+/*
+ * stackDistAccess - Records an access to the line with line address
+ * line (the address without its offset bits) that maps to set index.
+ */
+void stackDistAccess(stackDist* sd, unsigned long long line,
+					 unsigned long long index);
+
+/*
+ * stackDistResults - Reports the hits, misses and evictions of an LRU
+ * cache with 2^s sets of E lines each, for 1 <= E <= maxE.
+ */
+void stackDistResults(stackDist* sd, int E, unsigned long long* hits,
+					  unsigned long long* misses,
+					  unsigned long long* evictions);
+
+/*
+ * stackDistFullResults - Reports the hits, misses and evictions of a
+ * fully associative LRU cache with the same total number of lines as
+ * 2^s sets of E lines each, for 1 <= E <= maxE.
+ */
+void stackDistFullResults(stackDist* sd, int E, unsigned long long* hits,
+						  unsigned long long* misses,
+						  unsigned long long* evictions);
+
+/*
+ * freeStackDist - Frees everything makeStackDist allocated.
+ */
+void freeStackDist(stackDist* sd);
+
+#endif /* STACKDIST_TOOLS_H */
@@ -0,0 +1,838 @@
+/*
+ * trace.c - Fast reader for valgrind lackey memory traces
+ *
+ * The trace is mapped into memory and decoded in place, which avoids
+ * the per-record overhead of stdio. Records look like
+ *
+ * 	I 0400d7d4,8
+ * 	 L 7ff000398,8
+ *
+ * where the address is hexadecimal and the size is decimal. A data
+ * access may be followed by a decimal timestamp, as in
+ *
+ * 	 S 7ff000398,8 1042
+ *
+ * which is only used to interleave per-core traces. Binary
+ * traces (see trace.h) are mapped the same way and decoded with a
+ * varint loop instead.
+ *
+ * Either kind of trace may be gzip or zstd compressed, which is told
+ * by the magic number at its start. Compressed traces are streamed
+ * like stdin, with the producer thread decompressing them as it reads.
+ * gzip is inflated with zlib straight from the mapping. zstd uses
+ * libzstd the same way when built with HAVE_ZSTD, and otherwise the
+ * zstd tool, which decompresses in a child process into a pipe.
+ */
+#define _GNU_SOURCE /* for pipe2 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "trace.h"
+
+/* How a trace file is compressed */
+typedef enum traceCodec {
+	CODEC_NONE,
+	CODEC_GZIP,
+	CODEC_ZSTD
+} traceCodec;
+
+/*
+ * Value of every character as a hexadecimal digit, or 0xff if the
+ * character is not a digit. Decoding a number is then one table
+ * lookup and one compare per character.
+ */
+static const unsigned char hexDigits[256] = {
+	[0 ... 255] = 0xff,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+/*
+ * Reader state.
+ *  data, length - the mapped file
+ *  pos - the next byte to decode
+ *  end - the end of the last complete (newline terminated) line
+ *  tail - a newline terminated copy of a final line that has no
+ *  		newline of its own, or NULL
+ *  inTail - 1 once pos and end point into tail
+ *  binary - 1 if the trace is a binary trace
+ *  remaining - # of records of a binary trace left to decode
+ *  address - the previous address of a binary trace
+ *
+ * Traces that cannot be mapped, such as stdin and FIFOs, are streamed
+ * instead. A producer thread reads and decodes them into two batch 
+ * slots in turn, while traceRead hands out records from the other
+ * slot, so memory use is bounded no matter how long the trace is.
+ *  stream - 1 if the trace is streamed
+ *  raw - the chunk of input the producer is decoding
+ *  batches, counts - the two slots and how many records each holds
+ *  ready - 1 while a slot is full and waiting for the consumer
+ *  slot, taken - the slot the consumer is on and how much of it it used
+ *  done - 1 once the producer has published everything
+ *  stopping - 1 once traceClose wants the producer to stop
+ *  wake - a pipe whose write end traceClose closes to wake a producer
+ *  		blocked on fd
+ *
+ * Compressed traces are streamed too, with the producer decompressing
+ * the mapping rather than reading fd.
+ *  codec - how the trace is compressed
+ *  packed, packedLeft - the compressed input not yet given to zlib
+ *  zs - the zlib inflate state of a gzip trace
+ *  zstd, zin - the libzstd state and input of a zstd trace
+ *  child - the zstd process a zstd trace is piped from, or 0
+ */
+struct traceReader {
+	int fd;
+	char* data;
+	size_t length;
+	const char* pos;
+	const char* end;
+	char* tail;
+	size_t tailLength;
+	int inTail;
+	int binary;
+	unsigned long long remaining;
+	unsigned long long address;
+	int stream;
+	char* raw;
+	traceRecord* batches[2];
+	size_t counts[2];
+	int ready[2];
+	int slot;
+	size_t taken;
+	int done;
+	int stopping;
+	int wake[2];
+	pthread_t producer;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	traceCodec codec;
+	const unsigned char* packed;
+	size_t packedLeft;
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream* zstd;
+	ZSTD_inBuffer zin;
+#endif
+	pid_t child;
+};
+
+/*
+ * Writer state. Records are encoded into buffer and written out when
+ * it fills up.
+ */
+struct traceWriter {
+	FILE* file;
+	unsigned char buffer[1 << 16];
+	size_t used;
+	unsigned long long records;
+	unsigned long long bytes;
+	unsigned long long address;
+};
+
+/* Bytes of input a streamed trace reads at a time */
+#define TRACE_STREAM_CHUNK (1 << 20)
+
+/* Records in each of the two batch slots of a streamed trace */
+#define TRACE_STREAM_BATCH (16 * TRACE_BATCH)
+
+/* Most bytes a binary record can take: op byte, size and address varints */
+#define TRACE_RECORD_MAX 16
+
+/* Ops in the order of their binary codes, starting with 1 */
+static const char binaryOps[4] = { 0, 'L', 'S', 'M' };
+
+size_t traceParse(const char** pos, const char* end,
+				  traceRecord* batch, size_t max){
+	const char* p = *pos;
+	size_t n = 0;
+
+	/* Every line ends with a newline, which is neither a space nor a
+	 * digit, so none of the loops below can run off the end of a line. */
+	while(n < max && p < end){
+		while(*p == ' ' || *p == '\t'){
+			p++;
+		}
+		char op = *p;
+		if(op == 'L' || op == 'S' || op == 'M'){
+			p++;
+			while(*p == ' '){
+				p++;
+			}
+			unsigned long long address = 0;
+			unsigned char d;
+			while((d = hexDigits[(unsigned char) *p]) < 16){
+				address = (address << 4) | d;
+				p++;
+			}
+			unsigned int size = 0;
+			if(*p == ','){
+				p++;
+				while((d = hexDigits[(unsigned char) *p]) < 10){
+					size = size * 10 + d;
+					p++;
+				}
+			}
+			unsigned long long time = 0;
+			if(*p == ' '){
+				while(*p == ' '){
+					p++;
+				}
+				while((d = hexDigits[(unsigned char) *p]) < 10){
+					time = time * 10 + d;
+					p++;
+				}
+			}
+			batch[n].address = address;
+			batch[n].time = time;
+			batch[n].size = size;
+			batch[n].op = op;
+			n++;
+		}
+		/* Instruction loads, blank lines and anything we do not
+		 * understand are skipped along with the rest of the line. */
+		if(*p != '\n'){
+			p = memchr(p, '\n', end - p);
+		}
+		p++;
+	}
+	*pos = p;
+	return n;
+}
+
+/*
+ * Decodes a varint from [*pos, end), advancing *pos past it. A varint
+ * cut short by the end of the trace decodes to whatever was read.
+ */
+static inline unsigned long long decodeVarint(const unsigned char** pos,
+											  const unsigned char* end){
+	const unsigned char* p = *pos;
+	unsigned long long value = 0;
+	int shift = 0;
+	while(p < end){
+		unsigned char byte = *p++;
+		value |= (unsigned long long) (byte & 0x7f) << shift;
+		if(!(byte & 0x80)){
+			break;
+		}
+		shift += 7;
+	}
+	*pos = p;
+	return value;
+}
+
+/*
+ * Decodes up to max binary records that start in [*pos, limit) into 
+ * batch, advancing *pos and the previous address *address past them.
+ * Records may run on past limit, but not past end.
+ */
+static size_t decodeBinary(const unsigned char** pos, const unsigned char* limit,
+						   const unsigned char* end, unsigned long long* address,
+						   traceRecord* batch, size_t max){
+	const unsigned char* p = *pos;
+	unsigned long long last = *address;
+	size_t n = 0;
+	while(n < max && p < limit){
+		unsigned char byte = *p++;
+		unsigned int size = byte & TRACE_SIZE_ESCAPE;
+		if(size == TRACE_SIZE_ESCAPE){
+			size = decodeVarint(&p, end);
+		}
+		unsigned long long zigzag = decodeVarint(&p, end);
+		last += (zigzag >> 1) ^ -(zigzag & 1);
+		batch[n].address = last;
+		batch[n].time = 0;
+		batch[n].size = size;
+		batch[n].op = binaryOps[byte >> 6];
+		n++;
+	}
+	*pos = p;
+	*address = last;
+	return n;
+}
+
+/* Decodes up to max records of a mapped binary trace */
+static size_t binaryRead(traceReader* reader, traceRecord* batch, size_t max){
+	const unsigned char* p = (const unsigned char*) reader->pos;
+	const unsigned char* end = (const unsigned char*) reader->end;
+
+	if(max > reader->remaining){
+		max = reader->remaining;
+	}
+	size_t n = decodeBinary(&p, end, end, &reader->address, batch, max);
+
+	reader->pos = (const char*) p;
+	/* A truncated trace ends early rather than decoding garbage */
+	reader->remaining = (p < end) ? reader->remaining - n : 0;
+	return n;
+}
+
+/*
+ * Hands a filled batch in slot to the consumer, and then waits until
+ * the other slot is free for the producer to fill next. Returns 1 if
+ * the reader is being closed instead, and the producer should stop.
+ */
+static int publishBatch(traceReader* reader, int slot, size_t count){
+	pthread_mutex_lock(&reader->lock);
+	reader->counts[slot] = count;
+	reader->ready[slot] = 1;
+	pthread_cond_broadcast(&reader->changed);
+	while(reader->ready[slot ^ 1] && !reader->stopping){
+		pthread_cond_wait(&reader->changed, &reader->lock);
+	}
+	int stopping = reader->stopping;
+	pthread_mutex_unlock(&reader->lock);
+	return stopping;
+}
+
+/*
+ * Inflates up to n bytes of a gzip trace into buf, returning 0 at its
+ * end. Concatenated gzip members make up one trace, and a corrupt one
+ * ends the trace early.
+ */
+static ssize_t inflateInput(traceReader* reader, char* buf, size_t n){
+	z_stream* z = &reader->zs;
+	z->next_out = (Bytef*) buf;
+	z->avail_out = n;
+	while(z->avail_out > 0){
+		if(z->avail_in == 0){
+			if(reader->packedLeft == 0){
+				break;
+			}
+			/* zlib counts input in 32 bits, so feed a huge mapping in parts */
+			size_t take = (reader->packedLeft > (1U << 30)) ? (1U << 30) 
+															: reader->packedLeft;
+			z->next_in = (Bytef*) reader->packed;
+			z->avail_in = take;
+			reader->packed += take;
+			reader->packedLeft -= take;
+		}
+		int status = inflate(z, Z_NO_FLUSH);
+		if(status == Z_STREAM_END){
+			if(z->avail_in == 0 && reader->packedLeft == 0){
+				break;
+			}
+			inflateReset(z);
+		} else if(status != Z_OK){
+			reader->packedLeft = 0;
+			z->avail_in = 0;
+			break;
+		}
+	}
+	return n - z->avail_out;
+}
+
+#ifdef HAVE_ZSTD
+/* Decompresses up to n bytes of a zstd trace into buf, like inflateInput */
+static ssize_t zstdInput(traceReader* reader, char* buf, size_t n){
+	ZSTD_outBuffer out = { buf, n, 0 };
+	while(out.pos < out.size && reader->zin.pos < reader->zin.size){
+		size_t status = ZSTD_decompressStream(reader->zstd, &out, &reader->zin);
+		if(ZSTD_isError(status)){
+			reader->zin.pos = reader->zin.size;
+			break;
+		}
+	}
+	return out.pos;
+}
+#endif
+
+/*
+ * Reads more of a streamed trace into buf, returning 0 at its end or
+ * once traceClose closes the write end of reader->wake.
+ */
+static ssize_t streamInput(traceReader* reader, char* buf, size_t n){
+	if(reader->codec == CODEC_GZIP){
+		return inflateInput(reader, buf, n);
+	}
+#ifdef HAVE_ZSTD
+	if(reader->codec == CODEC_ZSTD){
+		return zstdInput(reader, buf, n);
+	}
+#endif
+	struct pollfd fds[2] = {
+		{ .fd = reader->fd, .events = POLLIN },
+		{ .fd = reader->wake[0], .events = POLLIN }
+	};
+	int polled;
+	do {
+		polled = poll(fds, 2, -1);
+	} while(polled < 0 && errno == EINTR);
+	if(polled < 0 || fds[1].revents != 0){
+		return 0;
+	}
+	ssize_t got;
+	do {
+		got = read(reader->fd, buf, n);
+	} while(got < 0 && errno == EINTR);
+	return got < 0 ? 0 : got;
+}
+
+/*
+ * Body of the producer thread of a streamed trace. It reads the input
+ * a chunk at a time into raw, decodes the chunk into the free batch 
+ * slot, and publishes the slot once it is full. Lines and records that
+ * straddle two chunks are moved to the front of raw and finished once
+ * the next chunk arrives. 
+ */
+static void* streamMain(void* arg){
+	traceReader* reader = (traceReader*) arg;
+	char* raw = reader->raw;
+	size_t start = 0;
+	size_t used = 0;
+	int eof = 0;
+	int slot = 0;
+	size_t count = 0;
+	int binary = -1;
+	int skipping = 0;
+
+	while(1){
+		/* Decode as much of raw as we can into the current slot */
+		traceRecord* batch = reader->batches[slot] + count;
+		size_t room = TRACE_STREAM_BATCH - count;
+		if(binary == 1){
+			/* Leave a possibly incomplete record for the next chunk, and
+			 * stop at the header's count like a mapped trace does */
+			size_t limit = used;
+			if(!eof){
+				limit = (used - start > TRACE_RECORD_MAX) ? used - TRACE_RECORD_MAX : start;
+			}
+			if(room > reader->remaining){
+				room = reader->remaining;
+			}
+			const unsigned char* p = (const unsigned char*) raw + start;
+			size_t n = decodeBinary(&p, (const unsigned char*) raw + limit,
+									(const unsigned char*) raw + used,
+									&reader->address, batch, room);
+			count += n;
+			reader->remaining -= n;
+			start = p - (const unsigned char*) raw;
+			if(reader->remaining == 0){
+				eof = 1;
+			}
+		} else if(binary == 0){
+			/* Drop the rest of a line too long to be a record */
+			if(skipping){
+				const char* newline = memchr(raw + start, '\n', used - start);
+				start = (newline != NULL) ? newline + 1 - raw : used;
+				skipping = newline == NULL;
+			}
+			const char* end = raw + used;
+			while(end > raw + start && end[-1] != '\n'){
+				end--;
+			}
+			const char* p = raw + start;
+			count += traceParse(&p, end, batch, room);
+			start = p - raw;
+			/* A line longer than the whole buffer cannot be a record */
+			if(end == raw + start && start == 0 && used == TRACE_STREAM_CHUNK){
+				start = used;
+				skipping = 1;
+			}
+		}
+
+		if(count == TRACE_STREAM_BATCH){
+			int stopping = publishBatch(reader, slot, count);
+			slot ^= 1;
+			count = 0;
+			if(stopping){
+				break;
+			}
+			continue;
+		}
+		if(eof){
+			break;
+		}
+
+		/* Out of complete input, so read the next chunk */
+		memmove(raw, raw + start, used - start);
+		used -= start;
+		start = 0;
+		ssize_t got = streamInput(reader, raw + used, TRACE_STREAM_CHUNK - used);
+		if(got == 0){
+			eof = 1;
+			/* Terminate a final line that lacks a newline */
+			if(binary != 1 && used > 0 && raw[used - 1] != '\n'){
+				raw[used++] = '\n';
+			}
+		}
+		used += got;
+
+		/* Once we have a header's worth of input, or all of it, we 
+		 * know which kind of trace it is */
+		if(binary < 0 && (used >= sizeof(traceHeader) || eof)){
+			const traceHeader* header = (const traceHeader*) raw;
+			binary = used >= sizeof(traceHeader) &&
+					 memcmp(header->magic, TRACE_MAGIC, 4) == 0 &&
+					 header->version == TRACE_VERSION;
+			if(binary){
+				start = sizeof(traceHeader);
+				reader->remaining = header->records;
+			}
+		}
+	}
+
+	/* Publish what is left, then tell the consumer we are done */
+	if(count > 0){
+		publishBatch(reader, slot, count);
+	}
+	pthread_mutex_lock(&reader->lock);
+	reader->done = 1;
+	pthread_cond_broadcast(&reader->changed);
+	pthread_mutex_unlock(&reader->lock);
+	return NULL;
+}
+
+/*
+ * Copies up to max records of a streamed trace out of the slot the 
+ * consumer is on, moving on to the other slot once it is used up. 
+ */
+static size_t streamRead(traceReader* reader, traceRecord* batch, size_t max){
+	size_t n = 0;
+	pthread_mutex_lock(&reader->lock);
+	while(n < max){
+		int slot = reader->slot;
+		if(!reader->ready[slot]){
+			if(reader->done){
+				break;
+			}
+			pthread_cond_wait(&reader->changed, &reader->lock);
+			continue;
+		}
+
+		size_t available = reader->counts[slot] - reader->taken;
+		size_t take = (max - n < available) ? max - n : available;
+		memcpy(batch + n, reader->batches[slot] + reader->taken, 
+				take * sizeof(traceRecord));
+		n += take;
+		reader->taken += take;
+
+		/* Give a used up slot back to the producer */
+		if(reader->taken == reader->counts[slot]){
+			reader->ready[slot] = 0;
+			reader->taken = 0;
+			reader->slot ^= 1;
+			pthread_cond_broadcast(&reader->changed);
+		}
+	}
+	pthread_mutex_unlock(&reader->lock);
+	return n;
+}
+
+/*
+ * Starts streaming the trace on reader->fd, which is a pipe, FIFO or
+ * anything else that cannot be mapped. Returns NULL if the producer
+ * cannot be set up.
+ */
+static traceReader* streamOpen(traceReader* reader){
+	if(pipe2(reader->wake, O_CLOEXEC) != 0){
+		return NULL;
+	}
+	reader->stream = 1;
+	reader->raw = (char*) malloc(TRACE_STREAM_CHUNK + 1);
+	reader->batches[0] = (traceRecord*) malloc(sizeof(traceRecord) * TRACE_STREAM_BATCH);
+	reader->batches[1] = (traceRecord*) malloc(sizeof(traceRecord) * TRACE_STREAM_BATCH);
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->changed, NULL);
+	pthread_create(&reader->producer, NULL, streamMain, reader);
+	return reader;
+}
+
+/*
+ * Starts streaming a compressed trace, whose mapping reader holds.
+ * Returns NULL if it cannot be decompressed.
+ */
+static traceReader* compressedOpen(traceReader* reader, traceCodec codec){
+	reader->codec = codec;
+	if(codec == CODEC_GZIP){
+		reader->packed = (const unsigned char*) reader->data;
+		reader->packedLeft = reader->length;
+		/* 15 + 32 accepts both gzip and zlib headers */
+		if(inflateInit2(&reader->zs, 15 + 32) != Z_OK){
+			return NULL;
+		}
+		return streamOpen(reader);
+	}
+#ifdef HAVE_ZSTD
+	reader->zstd = ZSTD_createDStream();
+	if(reader->zstd == NULL){
+		return NULL;
+	}
+	ZSTD_initDStream(reader->zstd);
+	reader->zin.src = reader->data;
+	reader->zin.size = reader->length;
+	reader->zin.pos = 0;
+	return streamOpen(reader);
+#else
+	/* Without libzstd, the zstd tool decompresses the file into a pipe,
+	 * which is then streamed like any other */
+	int fds[2];
+	if(pipe2(fds, O_CLOEXEC) != 0){
+		return NULL;
+	}
+	pid_t child = fork();
+	if(child < 0){
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+	if(child == 0){
+		dup2(reader->fd, STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execlp("zstd", "zstd", "-dcq", (char*) NULL);
+		perror("cannot run zstd to decompress the trace");
+		_exit(127);
+	}
+	close(fds[1]);
+	munmap(reader->data, reader->length);
+	reader->length = 0;
+	close(reader->fd);
+	reader->fd = fds[0];
+	reader->child = child;
+	return streamOpen(reader);
+#endif
+}
+
+traceReader* traceOpen(const char* path){
+	if(path == NULL){
+		return NULL;
+	}
+	int fd = (strcmp(path, "-") == 0) ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) 
+									  : open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0){
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0){
+		close(fd);
+		return NULL;
+	}
+
+	traceReader* reader = (traceReader*) calloc(1, sizeof(traceReader));
+	reader->fd = fd;
+	if(!S_ISREG(st.st_mode)){
+		traceReader* streamed = streamOpen(reader);
+		if(streamed == NULL){
+			traceClose(reader);
+		}
+		return streamed;
+	}
+	reader->length = st.st_size;
+	if(reader->length > 0){
+		reader->data = mmap(NULL, reader->length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(reader->data == MAP_FAILED){
+			close(fd);
+			free(reader);
+			return NULL;
+		}
+		/* We read the trace front to back exactly once */
+		madvise(reader->data, reader->length, MADV_SEQUENTIAL);
+	}
+
+	/* Compressed traces are recognized by their magic numbers */
+	const unsigned char* magic = (const unsigned char*) reader->data;
+	if(reader->length >= 4 && magic[0] == 0x1f && magic[1] == 0x8b){
+		traceReader* compressed = compressedOpen(reader, CODEC_GZIP);
+		if(compressed == NULL){
+			traceClose(reader);
+		}
+		return compressed;
+	}
+	if(reader->length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+	   magic[2] == 0x2f && magic[3] == 0xfd){
+		traceReader* compressed = compressedOpen(reader, CODEC_ZSTD);
+		if(compressed == NULL){
+			traceClose(reader);
+		}
+		return compressed;
+	}
+
+	/* Binary traces are decoded straight from the mapping */
+	const traceHeader* header = (const traceHeader*) reader->data;
+	if(reader->length >= sizeof(traceHeader) && 
+			memcmp(header->magic, TRACE_MAGIC, 4) == 0 &&
+			header->version == TRACE_VERSION){
+		reader->binary = 1;
+		reader->remaining = header->records;
+		reader->pos = reader->data + sizeof(traceHeader);
+		reader->end = reader->data + reader->length;
+		return reader;
+	}
+
+	/* Find the last newline. Anything after it is copied out so that
+	 * the parser can rely on every line being terminated. */
+	const char* start = reader->data;
+	const char* end = start + reader->length;
+	while(end > start && end[-1] != '\n'){
+		end--;
+	}
+	size_t rest = start + reader->length - end;
+	if(rest > 0){
+		reader->tail = (char*) malloc(rest + 1);
+		memcpy(reader->tail, end, rest);
+		reader->tail[rest] = '\n';
+		reader->tailLength = rest + 1;
+	}
+	reader->pos = start;
+	reader->end = end;
+	return reader;
+}
+
+size_t traceRead(traceReader* reader, traceRecord* batch, size_t max){
+	if(reader->stream){
+		return streamRead(reader, batch, max);
+	}
+	if(reader->binary){
+		return binaryRead(reader, batch, max);
+	}
+	size_t n = traceParse(&reader->pos, reader->end, batch, max);
+	if(n < max && reader->tail != NULL && !reader->inTail){
+		/* Switch over to the unterminated final line */
+		reader->pos = reader->tail;
+		reader->end = reader->tail + reader->tailLength;
+		reader->inTail = 1;
+		n += traceParse(&reader->pos, reader->end, batch + n, max - n);
+	}
+	return n;
+}
+
+int traceClose(traceReader* reader){
+	/* A decompressor only has to succeed if we read all it wrote */
+	int finished = 1;
+	if(reader->stream){
+		/* The producer may still be waiting for a free slot or blocked
+		 * on input we no longer want */
+		pthread_mutex_lock(&reader->lock);
+		finished = reader->done;
+		reader->stopping = 1;
+		pthread_cond_broadcast(&reader->changed);
+		pthread_mutex_unlock(&reader->lock);
+		close(reader->wake[1]);
+		pthread_join(reader->producer, NULL);
+		close(reader->wake[0]);
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->changed);
+		free(reader->raw);
+		free(reader->batches[0]);
+		free(reader->batches[1]);
+	}
+	if(reader->codec == CODEC_GZIP){
+		inflateEnd(&reader->zs);
+	}
+#ifdef HAVE_ZSTD
+	if(reader->zstd != NULL){
+		ZSTD_freeDStream(reader->zstd);
+	}
+#endif
+	if(reader->length > 0){
+		munmap(reader->data, reader->length);
+	}
+	free(reader->tail);
+	close(reader->fd);
+	/* Closing the pipe stops a zstd that is still writing to it. One 
+	 * that failed, or could not be run at all, cut the trace short. */
+	int status = 0;
+	if(reader->child > 0){
+		int exitStatus;
+		pid_t waited;
+		do {
+			waited = waitpid(reader->child, &exitStatus, 0);
+		} while(waited < 0 && errno == EINTR);
+		if(finished && (waited < 0 || !WIFEXITED(exitStatus) || WEXITSTATUS(exitStatus) != 0)){
+			status = -1;
+		}
+	}
+	free(reader);
+	return status;
+}
+
+/* Writes out whatever the writer has buffered */
+static void flushWriter(traceWriter* writer){
+	fwrite(writer->buffer, 1, writer->used, writer->file);
+	writer->bytes += writer->used;
+	writer->used = 0;
+}
+
+/* Appends value to the writer's buffer as a varint */
+static inline void encodeVarint(traceWriter* writer, unsigned long long value){
+	while(value >= 0x80){
+		writer->buffer[writer->used++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	writer->buffer[writer->used++] = (unsigned char) value;
+}
+
+traceWriter* traceCreate(const char* path){
+	FILE* file = fopen(path, "wb");
+	if(file == NULL){
+		return NULL;
+	}
+	traceWriter* writer = (traceWriter*) calloc(1, sizeof(traceWriter));
+	writer->file = file;
+
+	/* The record count is filled in by traceFinish */
+	traceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	fwrite(&header, sizeof(header), 1, file);
+	writer->bytes = sizeof(header);
+	return writer;
+}
+
+void traceWrite(traceWriter* writer, const traceRecord* records, size_t n){
+	for(size_t i = 0; i < n; i++){
+		if(writer->used + TRACE_RECORD_MAX > sizeof(writer->buffer)){
+			flushWriter(writer);
+		}
+		int op = records[i].op == 'L' ? 1 : records[i].op == 'S' ? 2 : 3;
+		unsigned int size = records[i].size;
+		if(size >= TRACE_SIZE_ESCAPE){
+			writer->buffer[writer->used++] = (op << 6) | TRACE_SIZE_ESCAPE;
+			encodeVarint(writer, size);
+		} else {
+			writer->buffer[writer->used++] = (op << 6) | size;
+		}
+		/* Zigzag keeps small negative deltas small */
+		long long delta = (long long) (records[i].address - writer->address);
+		encodeVarint(writer, ((unsigned long long) delta << 1) ^ (delta >> 63));
+		writer->address = records[i].address;
+	}
+	writer->records += n;
+}
+
+unsigned long long traceFinish(traceWriter* writer){
+	flushWriter(writer);
+	traceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	header.records = writer->records;
+
+	unsigned long long bytes = writer->bytes;
+	if(fseek(writer->file, 0, SEEK_SET) != 0 ||
+			fwrite(&header, sizeof(header), 1, writer->file) != 1){
+		bytes = 0;
+	}
+	if(fclose(writer->file) != 0){
+		bytes = 0;
+	}
+	free(writer);
+	return bytes;
+}
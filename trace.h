@@ -0,0 +1,97 @@
+/*
+ * trace.h - Prototypes for reading valgrind lackey memory traces
+ */
+
+#ifndef TRACE_TOOLS_H
+#define TRACE_TOOLS_H
+
+#include <stddef.h>
+
+/* Number of records handed to the simulator per call to traceRead */
+#define TRACE_BATCH 4096
+
+/*
+ * A single decoded data access from a trace. Instruction loads ('I')
+ * are never emitted.
+ *  op - 'L', 'S' or 'M'
+ *  size - number of bytes accessed
+ *  address - the address of the first byte accessed
+ *  time - an optional decimal timestamp following the size in a text
+ *  		trace, used to interleave the traces of several cores, or 0
+ */
+typedef struct traceRecord {
+	unsigned long long address;
+	unsigned long long time;
+	unsigned int size;
+	char op;
+} traceRecord;
+
+typedef struct traceReader traceReader;
+
+/*
+ * Binary traces start with a traceHeader followed by the records. Each
+ * record is a byte holding the op in its top two bits (1 for L, 2 for
+ * S, 3 for M) and the size in its low six bits, followed by the
+ * difference from the previous record's address as a zigzag varint.
+ * Sizes of TRACE_SIZE_ESCAPE or more store TRACE_SIZE_ESCAPE in the
+ * byte and the size as a varint right after it.
+ */
+#define TRACE_MAGIC "CSTB"
+#define TRACE_VERSION 1
+#define TRACE_SIZE_ESCAPE 63
+
+typedef struct traceHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned long long records;
+} traceHeader;
+
+typedef struct traceWriter traceWriter;
+
+/*
+ * traceOpen - Opens a text or binary trace file for reading, telling
+ * the two apart by the binary header. Returns NULL if the file cannot
+ * be opened or mapped.
+ */
+traceReader* traceOpen(const char* path);
+
+/*
+ * traceRead - Decodes up to max records into batch. Returns the number
+ * of records decoded, which is 0 once the trace is exhausted.
+ */
+size_t traceRead(traceReader* reader, traceRecord* batch, size_t max);
+
+/*
+ * traceClose - Releases the trace and everything traceOpen allocated.
+ * Returns 0, or -1 if the trace was read to its end but the zstd tool
+ * that decompressed it failed, so the end came early.
+ */
+int traceClose(traceReader* reader);
+
+/*
+ * traceCreate - Creates a binary trace file at path. Returns NULL if
+ * the file cannot be created.
+ */
+traceWriter* traceCreate(const char* path);
+
+/*
+ * traceWrite - Appends n records to a binary trace.
+ */
+void traceWrite(traceWriter* writer, const traceRecord* records, size_t n);
+
+/*
+ * traceFinish - Records the final record count in the header of a
+ * binary trace and closes it. Returns the number of bytes written, or
+ * 0 if writing failed.
+ */
+unsigned long long traceFinish(traceWriter* writer);
+
+/*
+ * traceParse - Decodes up to max records from the text in [*pos, end),
+ * which must end with a newline. *pos is advanced past every line that
+ * was consumed. Returns the number of records decoded.
+ */
+size_t traceParse(const char** pos, const char* end,
+				  traceRecord* batch, size_t max);
+
+#endif /* TRACE_TOOLS_H */
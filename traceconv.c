@@ -0,0 +1,55 @@
+/* 
+ * traceconv.c - Converts a text lackey trace into a binary trace
+ * 
+ * usage: traceconv <text trace> <binary trace>
+ * Writes every L, S and M record of the text trace to the binary
+ * trace, which cachesim reads directly and much faster. See trace.h
+ * for the format.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <text trace> <binary trace>\n", argv[0]);
+    exit(1);
+  }
+
+  traceReader* reader = traceOpen(argv[1]);
+  if (reader == NULL) {
+    fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[1]);
+    exit(1);
+  }
+  traceWriter* writer = traceCreate(argv[2]);
+  if (writer == NULL) {
+    fprintf(stderr, "%s: cannot create %s\n", argv[0], argv[2]);
+    exit(1);
+  }
+
+  traceRecord batch[TRACE_BATCH];
+  size_t n;
+  unsigned long long records = 0;
+  while ((n = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+    traceWrite(writer, batch, n);
+    records += n;
+  }
+  if (traceClose(reader) != 0) {
+    fprintf(stderr, "%s: cannot decompress %s\n", argv[0], argv[1]);
+    exit(1);
+  }
+
+  unsigned long long bytes = traceFinish(writer);
+  if (bytes == 0) {
+    fprintf(stderr, "%s: writing %s failed\n", argv[0], argv[2]);
+    exit(1);
+  }
+
+  struct stat st;
+  stat(argv[1], &st);
+  printf("%llu records, %lld bytes -> %llu bytes (%.1fx smaller)\n",
+         records, (long long) st.st_size, bytes, (double) st.st_size / bytes);
+  exit(0);
+}
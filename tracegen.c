@@ -0,0 +1,278 @@
+/*
+ * tracegen.c - Generates synthetic memory traces
+ *
+ * usage: tracegen [-n accesses] [-F footprint] [-S stride] [-z theta]
+ *                 [-N n] [-B block] [-x seed] <pattern> <trace>
+ * Writes the accesses of one pattern to a binary trace, or as lackey
+ * text to stdout if the trace is -. The patterns are
+ *  seq - 8 byte loads walking the footprint over and over
+ *  stride - loads S bytes apart, wrapping around the footprint
+ *  random - 8 byte loads spread uniformly over the footprint
+ *  zipf - 8 byte loads whose popularity follows a Zipf distribution
+ *  	with exponent theta, 0 < theta < 1, with popular items scattered
+ *  	over the footprint
+ *  chase - a pointer chase around a random cycle of 64 byte nodes
+ *  	filling the footprint
+ *  transpose, transpose-blocked - B = A^T on n by n doubles, naive and
+ *  	in block by block tiles
+ *  matmul, matmul-blocked - C += A * B on n by n doubles, naive (ijk)
+ *  	and in block by block tiles
+ * The kernels run to completion and ignore -n and -F.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* Where the generated footprint starts, and the size of most accesses */
+#define BASE 0x10000000ULL
+#define WORD 8
+
+typedef struct generator {
+	traceWriter* writer;
+	traceRecord batch[TRACE_BATCH];
+	size_t count;
+	unsigned long long records;
+	unsigned long long state;
+} generator;
+
+/* Appends one access to the trace */
+static inline void emit(generator* g, char op, unsigned long long address) {
+	if (g->writer == NULL) {
+		printf(" %c %llx,%d\n", op, address, WORD);
+		g->records++;
+		return;
+	}
+	traceRecord* record = &g->batch[g->count++];
+	record->op = op;
+	record->address = address;
+	record->size = WORD;
+	record->time = 0;
+	if (g->count == TRACE_BATCH) {
+		traceWrite(g->writer, g->batch, g->count);
+		g->records += g->count;
+		g->count = 0;
+	}
+}
+
+/* Returns the next number of a xorshift64* sequence */
+static inline unsigned long long next(generator* g) {
+	g->state ^= g->state >> 12;
+	g->state ^= g->state << 25;
+	g->state ^= g->state >> 27;
+	return g->state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Returns a uniform double in [0, 1) */
+static inline double uniform(generator* g) {
+	return (next(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Parses a byte count with an optional k, m or g suffix */
+static unsigned long long parseBytes(const char* text) {
+	char* end;
+	unsigned long long bytes = strtoull(text, &end, 10);
+	switch (*end) {
+		case 'k': case 'K': bytes <<= 10; break;
+		case 'm': case 'M': bytes <<= 20; break;
+		case 'g': case 'G': bytes <<= 30; break;
+	}
+	return bytes;
+}
+
+/*
+ * Draws n ranks in [0, items) with P(rank) proportional to
+ * 1 / (rank + 1)^theta, using the method of Gray et al. that YCSB
+ * uses, and scatters them over the footprint. The method only holds
+ * for 0 < theta < 1, which main checks.
+ */
+static void zipf(generator* g, unsigned long long n, unsigned long long items,
+                 double theta) {
+	double zetan = 0;
+	for (unsigned long long i = 1; i <= items; i++) {
+		zetan += 1.0 / pow((double) i, theta);
+	}
+	double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+	double alpha = 1.0 / (1.0 - theta);
+	double eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+	for (unsigned long long i = 0; i < n; i++) {
+		double u = uniform(g);
+		double uz = u * zetan;
+		unsigned long long rank;
+		if (uz < 1.0) {
+			rank = 0;
+		} else if (uz < zeta2) {
+			rank = 1;
+		} else {
+			rank = (unsigned long long) (items * pow(eta * u - eta + 1.0, alpha));
+			if (rank >= items) {
+				rank = items - 1;
+			}
+		}
+		unsigned long long item = (rank * 0x9E3779B97F4A7C15ULL) % items;
+		emit(g, 'L', BASE + item * WORD);
+	}
+}
+
+/* Follows a random cycle through every node n times in total */
+static void chase(generator* g, unsigned long long n, unsigned long long nodes) {
+	unsigned long long* successor = malloc(sizeof(unsigned long long) * nodes);
+	if (successor == NULL) {
+		fprintf(stderr, "tracegen: out of memory\n");
+		exit(1);
+	}
+	/* Sattolo's algorithm makes a permutation that is a single cycle */
+	for (unsigned long long i = 0; i < nodes; i++) {
+		successor[i] = i;
+	}
+	for (unsigned long long i = nodes - 1; i > 0; i--) {
+		unsigned long long j = next(g) % i;
+		unsigned long long t = successor[i];
+		successor[i] = successor[j];
+		successor[j] = t;
+	}
+	unsigned long long node = 0;
+	for (unsigned long long i = 0; i < n; i++) {
+		emit(g, 'L', BASE + node * 64);
+		node = successor[node];
+	}
+	free(successor);
+}
+
+/* B = A^T, in block by block tiles, or row by row if block is n */
+static void transpose(generator* g, unsigned long long n, unsigned long long block) {
+	unsigned long long a = BASE;
+	unsigned long long b = BASE + n * n * WORD;
+	for (unsigned long long ii = 0; ii < n; ii += block) {
+		for (unsigned long long jj = 0; jj < n; jj += block) {
+			for (unsigned long long i = ii; i < ii + block && i < n; i++) {
+				for (unsigned long long j = jj; j < jj + block && j < n; j++) {
+					emit(g, 'L', a + (i * n + j) * WORD);
+					emit(g, 'S', b + (j * n + i) * WORD);
+				}
+			}
+		}
+	}
+}
+
+/* C += A * B, in block by block tiles, or naively if block is n */
+static void matmul(generator* g, unsigned long long n, unsigned long long block) {
+	unsigned long long a = BASE;
+	unsigned long long b = BASE + n * n * WORD;
+	unsigned long long c = BASE + 2 * n * n * WORD;
+	for (unsigned long long ii = 0; ii < n; ii += block) {
+		for (unsigned long long jj = 0; jj < n; jj += block) {
+			for (unsigned long long kk = 0; kk < n; kk += block) {
+				for (unsigned long long i = ii; i < ii + block && i < n; i++) {
+					for (unsigned long long j = jj; j < jj + block && j < n; j++) {
+						for (unsigned long long k = kk; k < kk + block && k < n; k++) {
+							emit(g, 'L', a + (i * n + k) * WORD);
+							emit(g, 'L', b + (k * n + j) * WORD);
+						}
+						emit(g, 'M', c + (i * n + j) * WORD);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-n accesses] [-F footprint] [-S stride] "
+	        "[-z theta] [-N n] [-B block] [-x seed] <pattern> <trace>\n"
+	        "patterns: seq stride random zipf chase transpose "
+	        "transpose-blocked matmul matmul-blocked\n", name);
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	unsigned long long n = 1000000;
+	unsigned long long footprint = 1 << 20;
+	unsigned long long stride = 64;
+	double theta = 0.99;
+	unsigned long long size = 256;
+	unsigned long long block = 32;
+	unsigned long long seed = 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:F:S:z:N:B:x:")) != -1) {
+		switch (c) {
+			case 'n': n = strtoull(optarg, NULL, 10); break;
+			case 'F': footprint = parseBytes(optarg); break;
+			case 'S': stride = parseBytes(optarg); break;
+			case 'z': theta = atof(optarg); break;
+			case 'N': size = strtoull(optarg, NULL, 10); break;
+			case 'B': block = strtoull(optarg, NULL, 10); break;
+			case 'x': seed = strtoull(optarg, NULL, 10); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+	const char* pattern = argv[optind];
+	const char* path = argv[optind + 1];
+	if (footprint < 64 || stride == 0 || size == 0 || block == 0 ||
+	    theta <= 0 || theta >= 1.0) {
+		fprintf(stderr, "%s: footprint must be at least 64 bytes, stride, n and "
+		        "block positive, and theta between 0 and 1\n", argv[0]);
+		exit(1);
+	}
+
+	generator g;
+	g.count = 0;
+	g.records = 0;
+	g.state = seed * 0x9E3779B97F4A7C15ULL + 1;
+	g.writer = NULL;
+	if (strcmp(path, "-") != 0) {
+		g.writer = traceCreate(path);
+		if (g.writer == NULL) {
+			fprintf(stderr, "%s: cannot create %s\n", argv[0], path);
+			exit(1);
+		}
+	}
+
+	unsigned long long words = footprint / WORD;
+	if (strcmp(pattern, "seq") == 0) {
+		for (unsigned long long i = 0; i < n; i++) {
+			emit(&g, 'L', BASE + (i % words) * WORD);
+		}
+	} else if (strcmp(pattern, "stride") == 0) {
+		for (unsigned long long i = 0; i < n; i++) {
+			emit(&g, 'L', BASE + (i * stride) % footprint);
+		}
+	} else if (strcmp(pattern, "random") == 0) {
+		for (unsigned long long i = 0; i < n; i++) {
+			emit(&g, 'L', BASE + (next(&g) % words) * WORD);
+		}
+	} else if (strcmp(pattern, "zipf") == 0) {
+		zipf(&g, n, words, theta);
+	} else if (strcmp(pattern, "chase") == 0) {
+		chase(&g, n, footprint / 64);
+	} else if (strcmp(pattern, "transpose") == 0) {
+		transpose(&g, size, size);
+	} else if (strcmp(pattern, "transpose-blocked") == 0) {
+		transpose(&g, size, block);
+	} else if (strcmp(pattern, "matmul") == 0) {
+		matmul(&g, size, size);
+	} else if (strcmp(pattern, "matmul-blocked") == 0) {
+		matmul(&g, size, block);
+	} else {
+		fprintf(stderr, "%s: unknown pattern %s\n", argv[0], pattern);
+		usage(argv[0]);
+	}
+
+	if (g.writer != NULL) {
+		traceWrite(g.writer, g.batch, g.count);
+		g.records += g.count;
+		if (traceFinish(g.writer) == 0) {
+			fprintf(stderr, "%s: writing %s failed\n", argv[0], path);
+			exit(1);
+		}
+		fprintf(stderr, "%s: %llu records\n", pattern, g.records);
+	}
+	exit(0);
+}